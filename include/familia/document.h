@@ -20,6 +20,14 @@ struct Topic {
     }
 };
 
+// 文档推断的最终结果, 包含稀疏及稠密格式的文档主题分布
+struct DocTopicDist {
+    // 按照主题概率从大到小排序的稀疏主题分布, 与LDADoc::sparse_topic_dist一致
+    std::vector<Topic> sparse;
+    // 考虑了先验参数的稠密主题分布, 与LDADoc::dense_topic_dist一致
+    std::vector<float> dense;
+};
+
 // LDA文档存储基本单元，包含词id以及对应的主题id
 struct Token {
     int topic;
@@ -32,7 +40,40 @@ struct Sentence {
     std::vector<int> tokens;
 };
 
+// SLDADoc中一个句子的词id, 指向文档内按句子连续存放的词id数组
+struct SentenceTokens {
+    const int* data;
+    size_t count;
+
+    inline const int* begin() const {
+        return data;
+    }
+
+    inline const int* end() const {
+        return data + count;
+    }
+
+    inline size_t size() const {
+        return count;
+    }
+
+    inline int operator[](size_t index) const {
+        return data[index];
+    }
+};
+
+// SLDADoc中一个句子的只读视图, 包含句子主题及其词id
+struct SentenceView {
+    int topic;
+    SentenceTokens tokens;
+};
+
+// 文档长度乘以该比例仍小于主题数时视为短文本, 文档主题计数的维护只访问非零主题
+constexpr int SPARSE_DOC_TOPIC_RATIO = 8;
+
 // LDA模型inference结果存储结构
+// 文档主题计数使用长度为主题数的数组以便O(1)查询, 短文本的初始化和累积只访问非零主题,
+// 避免主题数很大时每轮采样O(K)的开销; 长文本自动使用逐主题的稠密方式
 class LDADoc {
 public:
     LDADoc() = default;
@@ -51,6 +92,10 @@ public:
         return _tokens[index];
     }
 
+    inline const Token& token(size_t index) const {
+        return _tokens[index];
+    }
+
     // 对文档中第index个单词的主题置为new_topic, 并更新相应的文档主题分布
     void set_topic(int index, int new_topic);
 
@@ -68,33 +113,88 @@ public:
         return _topic_sum[topic_id];
     }
 
+    // 返回文档在当前轮采样中的topic sum向量
+    inline const std::vector<int>& topic_sum() const {
+        return _topic_sum;
+    }
+
     // 返回稀疏格式的文档主题分布, 默认按照主题概率从大到小的排序
     // NOTE: 这一接口返回结果为了稀疏化，忽略了先验参数的作用
     void sparse_topic_dist(std::vector<Topic>& topic_dist, bool sort = true) const;
 
     // 返回稠密格式的文档主题分布, 考虑了先验参数的结果
+    // 文档长度由累积结果得到, 因此同样适用于以句子为单位采样的SLDADoc
     void dense_topic_dist(std::vector<float>& dense_dist) const;
 
+    // 返回多轮采样累积的topic sum向量
+    inline const std::vector<int>& accum_topic_sum() const {
+        return _accum_topic_sum;
+    }
+
+    // 返回累积计数可能非零的主题个数, 与accum_topic配合遍历累积结果
+    // 短文本只包含出现过的主题, 按首次出现的顺序排列; 长文本包含全部主题
+    inline size_t num_accum_topics() const {
+        return _sparse_accum ? _accum_topics.size() : _num_topics;
+    }
+
+    // 返回第index个累积计数可能非零的主题id, 多次累积之间已有主题的顺序保持不变
+    inline int accum_topic(size_t index) const {
+        return _sparse_accum ? _accum_topics[index] : static_cast<int>(index);
+    }
+
     // 对每轮采样结果进行累积, 以得到一个更逼近真实后验的分布
+    // 短文本逐词累积, 复杂度与文档长度相关而与主题数无关
     void accumulate_topic_sum();
 
+    // 将同一文档另一条采样链的累积结果合并到本文档, 合并后的分布为各链累积结果的平均
+    // REQUIRE: other与本文档的词序列相同且均已累积过采样结果
+    void merge_accum_topic_sum(const LDADoc& other);
+
+    // 记录推断实际使用的采样轮数
+    inline void set_num_sweeps(int num_sweeps) {
+        _num_sweeps = num_sweeps;
+    }
+
+    // 返回推断实际使用的采样轮数, 开启收敛检查时可能小于最大迭代轮数
+    inline int num_sweeps() const {
+        return _num_sweeps;
+    }
+
 protected:
+    // 清空累积结果, 上一篇文档为短文本时只清除其写入过的位置
+    void reset_accum_topic_sum(int num_topics);
+
+    // 将一轮采样中主题topic的计数count累积到结果中
+    inline void accumulate_topic(int topic, int count) {
+        if (_accum_topic_sum[topic] == 0) {
+            _accum_topics.push_back(topic);
+        }
+        _accum_topic_sum[topic] += count;
+    }
+
     // 主题数
-    int _num_topics;
+    int _num_topics = 0;
     // 累积的采样轮数
-    int _num_accum;
+    int _num_accum = 0;
+    // 推断实际使用的采样轮数
+    int _num_sweeps = 0;
     // 文档先验参数alpha
-    float _alpha;
+    float _alpha = 0.0;
+    // 累积结果是否只维护了出现过的主题
+    bool _sparse_accum = false;
     // inference 结果存储结构
     std::vector<Token> _tokens;
     // 文档在一轮采样中的topic sum
     std::vector<int> _topic_sum;
     // topic sum在多轮采样中的累积结果 
     std::vector<int> _accum_topic_sum;
+    // 短文本累积结果中出现过的主题, 按首次出现的顺序排列
+    std::vector<int> _accum_topics;
 };
 
 // Sentence LDA Document
 // 继承自LDADoc，新增了add_sentence接口
+// 各句子的词id按句子顺序连续存放(CSR格式), 文档复用时不再为每个句子分配内存
 class SLDADoc : public LDADoc {
 public:
     SLDADoc() = default;
@@ -102,23 +202,43 @@ public:
     void init(int num_topics);
 
     // 新增句子
-    void add_sentence(const Sentence& sent);
+    void add_sentence(const Sentence& sent) {
+        add_sentence(sent.topic, sent.tokens.data(), sent.tokens.size());
+    }
+
+    // 新增主题为topic、包含ids[0, size)的句子
+    void add_sentence(int topic, const int* ids, size_t size);
 
     // 对文档中第index个句子的主题置为new_topic, 并更新相应的文档主题分布
     void set_topic(int index, int new_topic);
 
+    // 对每轮采样结果进行累积, 短文本只访问句子的主题
+    void accumulate_topic_sum();
+
     // 返回文档句子数量
     inline size_t size() const {
-        return _sentences.size();
+        return _sent_topics.size();
     }
-    
-    inline Sentence& sent(size_t index) {
-        return _sentences[index];
+
+    // 返回第index个句子的视图, 在下一次add_sentence或init之前有效
+    inline SentenceView sent(size_t index) const {
+        return {_sent_topics[index],
+                {_word_ids.data() + _sent_offsets[index],
+                 _sent_offsets[index + 1] - _sent_offsets[index]}};
+    }
+
+    // 返回第index个句子的主题
+    inline int sent_topic(size_t index) const {
+        return _sent_topics[index];
     }
 
 private:
-    // 文档为句子的集合，每个句子有一个对应主题
-    std::vector<Sentence> _sentences;
+    // 每个句子对应的主题
+    std::vector<int> _sent_topics;
+    // 第i个句子的词id为_word_ids[_sent_offsets[i], _sent_offsets[i + 1])
+    std::vector<size_t> _sent_offsets = std::vector<size_t>(1, 0);
+    // 所有句子的词id
+    std::vector<int> _word_ids;
 };
 } // namespace familia
 #endif  // FAMILIA_DOCUMENT_H
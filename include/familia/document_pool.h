@@ -0,0 +1,108 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef FAMILIA_DOCUMENT_POOL_H
+#define FAMILIA_DOCUMENT_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace familia {
+
+// 可复用文档对象池, Doc为LDADoc或SLDADoc
+// 文档从池中借出, 用完后自动归还; 文档的init只清除上一篇文档访问过的主题并保留各数组的容量,
+// 因此服务稳定后每个请求的推断不再分配堆内存
+// 线程安全, 多个线程可同时借还
+template <typename Doc>
+class DocumentPool {
+public:
+    // 借出的文档, 析构时归还给所属的对象池
+    class PooledDoc {
+    public:
+        PooledDoc(DocumentPool* pool, std::unique_ptr<Doc> doc) :
+            _pool(pool), _doc(std::move(doc)) {
+        }
+
+        PooledDoc(PooledDoc&& other) = default;
+
+        ~PooledDoc() {
+            if (_doc) {
+                _pool->release(std::move(_doc));
+            }
+        }
+
+        inline Doc& operator*() const {
+            return *_doc;
+        }
+
+        inline Doc* operator->() const {
+            return _doc.get();
+        }
+
+        inline Doc* get() const {
+            return _doc.get();
+        }
+
+        // no copying allowed
+        PooledDoc(const PooledDoc&) = delete;
+        PooledDoc& operator=(const PooledDoc&) = delete;
+
+    private:
+        DocumentPool* _pool;
+        std::unique_ptr<Doc> _doc;
+    };
+
+    // max_idle为池中最多保留的空闲文档数, 超出部分归还时直接释放
+    explicit DocumentPool(size_t max_idle = DEFAULT_MAX_IDLE) : _max_idle(max_idle) {
+        // 预留空间, 保证归还时不再分配内存
+        _idle.reserve(max_idle);
+    }
+
+    // 借出一篇文档, 池为空时新建; 文档内容为上一次使用后的状态, 由infer负责重新初始化
+    PooledDoc acquire() {
+        std::unique_ptr<Doc> doc;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_idle.empty()) {
+                doc = std::move(_idle.back());
+                _idle.pop_back();
+            }
+        }
+        if (!doc) {
+            doc.reset(new Doc());
+        }
+        return PooledDoc(this, std::move(doc));
+    }
+
+    // 返回池中空闲文档的数量
+    size_t num_idle() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _idle.size();
+    }
+
+    // no copying allowed
+    DocumentPool(const DocumentPool&) = delete;
+    DocumentPool& operator=(const DocumentPool&) = delete;
+
+private:
+    static constexpr size_t DEFAULT_MAX_IDLE = 64;
+
+    void release(std::unique_ptr<Doc> doc) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_idle.size() < _max_idle) {
+            _idle.push_back(std::move(doc));
+        }
+    }
+
+    size_t _max_idle;
+    mutable std::mutex _mutex;
+    // 空闲文档, 后归还的先借出, 其缓冲区更可能仍在缓存中
+    std::vector<std::unique_ptr<Doc>> _idle;
+};
+
+template <typename Doc>
+constexpr size_t DocumentPool<Doc>::DEFAULT_MAX_IDLE;
+} // namespace familia
+#endif  // FAMILIA_DOCUMENT_POOL_H
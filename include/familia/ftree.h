@@ -0,0 +1,59 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef FAMILIA_FTREE_H
+#define FAMILIA_FTREE_H
+
+#include <vector>
+
+namespace familia {
+
+// F+树(F+ tree), 以完全二叉树的形式存储非负权重, 每个内部节点为其子节点权重之和
+// 支持O(log K)的单点更新和按权重采样, 节点按层连续存放, 靠近根的若干层常驻缓存
+class FTree {
+public:
+    FTree() : _size(0), _capacity(0) {
+    }
+
+    // 初始化为size个权重为0的叶子节点
+    void init(int size);
+
+    // 设置叶子节点的权重但不更新内部节点, 全部设置完成后需调用build
+    inline void set(int index, double weight) {
+        _nodes[_capacity + index] = weight;
+    }
+
+    // 自底向上计算所有内部节点, 复杂度O(K)
+    void build();
+
+    // 更新叶子节点的权重并同步更新其所有祖先节点, 复杂度O(log K)
+    void update(int index, double weight);
+
+    // 返回叶子节点的权重
+    inline double weight(int index) const {
+        return _nodes[_capacity + index];
+    }
+
+    // 返回所有叶子节点的权重之和
+    inline double total() const {
+        return _nodes[1];
+    }
+
+    // 返回前缀和首次超过dart的叶子下标, 其中dart位于[0, total())
+    int sample(double dart) const;
+
+    inline int size() const {
+        return _size;
+    }
+
+private:
+    // 叶子节点数
+    int _size;
+    // 不小于叶子节点数的2的幂, 叶子节点位于[_capacity, 2 * _capacity)
+    int _capacity;
+    // 以1为根的节点数组, 节点i的子节点为2i和2i + 1
+    std::vector<double> _nodes;
+};
+} // namespace familia
+#endif  // FAMILIA_FTREE_H
@@ -0,0 +1,65 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef FAMILIA_GIBBS_KERNEL_H
+#define FAMILIA_GIBBS_KERNEL_H
+
+#include <stdint.h>
+#include <vector>
+
+namespace familia {
+
+// 稠密吉布斯采样的向量化计算内核
+// 运行时根据CPU支持的指令集选择AVX2、SSE或标量实现
+// 各实现逐元素的运算顺序与标量实现相同, 因此结果完全一致
+// NOTE: 该结论依赖编译时不重排浮点运算, Makefile中本文件使用-fno-fast-math编译
+
+// 计算LDA各主题未归一化的条件概率:
+// prob[t] = (doc_counts[t] + alpha) * (word_counts[t] + beta) * inv_denominators[t]
+// 其中inv_denominators[t]为预先计算的1 / (topic_sum + beta_sum)
+// 乘以倒数与直接除以分母相比存在舍入差异, 实测最大相对误差为1.19e-7(约1 ulp)
+void gibbs_token_prob(const int32_t* doc_counts,
+                      const int32_t* word_counts,
+                      const float* inv_denominators,
+                      float alpha,
+                      float beta,
+                      int num_topics,
+                      float* prob);
+
+// 计算单个主题未归一化的条件概率, 与gibbs_token_prob逐元素的结果完全一致
+// 与内核在同一编译单元中以相同的浮点选项编译, 调用方可在-ffast-math下安全地混用两者的结果
+float gibbs_topic_prob(int32_t doc_count,
+                       int32_t word_count,
+                       float inv_denominator,
+                       float alpha,
+                       float beta);
+
+// 计算SentenceLDA各主题对数条件概率中与文档及词计数无关的部分:
+// log_prob[t] = offset - num_words * log_denominators[t]
+void gibbs_log_prob(const float* log_denominators,
+                    float num_words,
+                    float offset,
+                    int num_topics,
+                    float* log_prob);
+
+// 将对数概率原地转换为概率: prob[t] = exp(prob[t] - max_log_prob)
+// 其中exp使用多项式近似(相对误差约1e-7), 各实现使用相同的计算步骤
+void gibbs_exp_prob(float max_log_prob, int num_topics, float* prob);
+
+// 返回当前使用的内核实现名称
+const char* gibbs_kernel_name();
+
+// 一种内核实现的计算函数, 参数与上述同名函数相同
+struct GibbsKernel {
+    const char* name;
+    void (*token_prob)(const int32_t*, const int32_t*, const float*, float, float, int, float*);
+    void (*log_prob)(const float*, float, float, int, float*);
+    void (*exp_prob)(float, int, float*);
+};
+
+// 返回当前CPU支持的全部内核实现, 按AVX2、SSE、标量的顺序排列, 第一个即为运行时使用的实现
+// 主要用于测试各实现的结果是否一致
+const std::vector<GibbsKernel>& supported_gibbs_kernels();
+} // namespace familia
+#endif  // FAMILIA_GIBBS_KERNEL_H
@@ -0,0 +1,144 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef FAMILIA_INFERENCE_CONTEXT_H
+#define FAMILIA_INFERENCE_CONTEXT_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "familia/ftree.h"
+#include "familia/random.h"
+
+namespace familia {
+
+// 默认随机数种子, 推断时会根据文档内容重新设置种子
+constexpr uint64_t DEFAULT_RANDOM_SEED = 2147483647;
+
+// F+树采样器在上下文中保存的状态, 多轮采样及多篇文档之间复用, 只更新计数变化的主题
+struct FTreeState {
+    FTree tree;
+    // 构建该树的采样器标识, 与当前采样器不同时需重新构建
+    uint64_t owner = 0;
+    // 树中各叶子节点的权重所对应的文档主题计数
+    std::vector<int> counts;
+    // counts可能非零的主题, 可能包含重复的主题
+    std::vector<int> topics;
+};
+
+// 推断上下文, 持有一次推断过程所需的随机数引擎以及采样器的临时缓冲区
+// 采样器和模型本身只读, 每个线程使用各自的上下文即可共享同一个InferenceEngine
+// NOTE: 同一个上下文对象不能同时被多个线程使用
+class InferenceContext {
+public:
+    // 每次批量生成的随机数个数
+    static constexpr int RAND_BUFFER_SIZE = 256;
+
+    // rand_batch_size为每次批量生成的随机数个数, 需为Xoshiro256Plus::LANES的整数倍且不超过
+    // RAND_BUFFER_SIZE; 相同种子下的随机数序列与该值无关, 较小的值只使用缓冲区开头的少量缓存行,
+    // 适用于交错推断时组内每篇文档各持有一个上下文
+    explicit InferenceContext(int rand_batch_size = RAND_BUFFER_SIZE) :
+        _rand_batch_size(rand_batch_size) {
+        seed(DEFAULT_RANDOM_SEED);
+    }
+
+    // 重置随机数种子并丢弃已生成的随机数, 相同种子下的推断结果完全一致
+    inline void seed(uint64_t seed) {
+        _engine.seed(seed);
+        _rand_pos = _rand_batch_size;
+    }
+
+    // 返回[0, 1)之间的随机浮点数, 随机数预先批量生成, 每次调用只需读取缓冲区
+    inline double rand() {
+        if (_rand_pos == _rand_batch_size) {
+            _engine.fill_uniform(_rand_buffer, _rand_batch_size);
+            _rand_pos = 0;
+        }
+        return _rand_buffer[_rand_pos++];
+    }
+
+    // 返回[0, k - 1]之间的随机整数
+    inline int rand_k(int k) {
+        return static_cast<int>(rand() * k);
+    }
+
+    // 返回长度至少为size的浮点临时缓冲区, 用于存放各主题的概率
+    inline std::vector<float>& prob_buffer(size_t size) {
+        if (_prob.size() < size) {
+            _prob.resize(size);
+        }
+        return _prob;
+    }
+
+    // 返回长度至少为size的浮点临时缓冲区, 用于存放各主题的累积概率
+    inline std::vector<float>& accum_prob_buffer(size_t size) {
+        if (_accum_prob.size() < size) {
+            _accum_prob.resize(size);
+        }
+        return _accum_prob;
+    }
+
+    // 返回长度至少为size且全部为0的整数临时缓冲区, 用于展开词的稠密主题计数
+    // NOTE: 调用方使用完毕后需将写入过的位置恢复为0
+    inline std::vector<int32_t>& count_buffer(size_t size) {
+        if (_counts.size() < size) {
+            _counts.resize(size, 0);
+        }
+        return _counts;
+    }
+
+    // 返回浮点缓冲区, 用于存放上一个收敛检查点的文档主题分布, 内容由调用方维护
+    inline std::vector<float>& topic_dist_buffer() {
+        return _topic_dist;
+    }
+
+    // 返回整数临时缓冲区, 用于存放主题id列表, 内容由调用方维护
+    inline std::vector<int>& topic_buffer() {
+        return _topics;
+    }
+
+    // 返回整数临时缓冲区, 用于在推断前暂存输入文档的词id, 内容由调用方维护
+    inline std::vector<int>& id_buffer() {
+        return _ids;
+    }
+
+    // 返回整数缓冲区, 用于存放结果缓存的键对应的词id序列, 内容由调用方维护
+    inline std::vector<int>& key_buffer() {
+        return _key_ids;
+    }
+
+    // 返回整数缓冲区, 用于存放按词分组采样时文档中词的采样顺序, 内容由调用方维护
+    inline std::vector<int>& order_buffer() {
+        return _order;
+    }
+
+    // 返回F+树采样器的状态, 内容由采样器维护
+    inline FTreeState& ftree_state() {
+        return _ftree_state;
+    }
+
+    // no copying allowed
+    InferenceContext(const InferenceContext&) = delete;
+    InferenceContext& operator=(const InferenceContext&) = delete;
+
+private:
+    // 随机数引擎
+    Xoshiro256Plus _engine;
+    // 预先生成的[0, 1)均匀随机数, 只使用前_rand_batch_size个, 以及下一个待使用的位置
+    double _rand_buffer[RAND_BUFFER_SIZE];
+    int _rand_batch_size;
+    int _rand_pos;
+    // 采样器临时缓冲区
+    std::vector<float> _prob;
+    std::vector<float> _accum_prob;
+    std::vector<float> _topic_dist;
+    std::vector<int> _topics;
+    std::vector<int> _ids;
+    std::vector<int> _key_ids;
+    std::vector<int> _order;
+    std::vector<int32_t> _counts;
+    FTreeState _ftree_state;
+};
+} // namespace familia
+#endif // FAMILIA_INFERENCE_CONTEXT_H
@@ -6,6 +6,7 @@
 #define FAMILIA_INFERENCE_ENGINE_H
 
 #include <memory>
+#include <mutex>
 
 #include "familia/util.h"
 #include "familia/config.pb.h"
@@ -13,20 +14,29 @@
 #include "familia/model.h"
 #include "familia/sampler.h"
 #include "familia/document.h"
+#include "familia/document_pool.h"
+#include "familia/inference_context.h"
+#include "familia/result_cache.h"
+#include "familia/thread_pool.h"
 
 namespace familia {
 
 // 采样器类型
 enum class SamplerType {
     GibbsSampling = 0,
-    MetropolisHastings = 1
+    MetropolisHastings = 1,
+    SparseGibbsSampling = 2,
+    FTreeSampling = 3
 };
 
 // Inference Engine 支持LDA 和Sentence-LDA两种模型的主题推断, 两种模型使用相同的存储格式
-// 同时包含吉布斯采样和Metroplis-Hastings两种采样算法
+// 同时包含吉布斯采样、SparseLDA分桶吉布斯采样、F+树吉布斯采样和Metroplis-Hastings四种采样算法
+// 推断接口均为const, 随机数及临时状态存放在InferenceContext中, 同一个引擎可被多个线程共享
+// 每篇文档的随机数种子由其词id序列和配置的seed_salt决定, 推断结果与调用方式及线程无关
 class InferenceEngine {
 public:
-    ~InferenceEngine() = default;
+    // 启用结果缓存时输出缓存的命中统计
+    ~InferenceEngine();
 
     // 默认使用 Metroplis-Hastings 采样算法
     InferenceEngine(const std::string& model_dir, 
@@ -34,34 +44,167 @@ public:
                     SamplerType type = SamplerType::MetropolisHastings);
     
     // 对input的输入进行LDA主题推断，输出结果存放在doc中
-    // 其中input是分词后字符串的集合
-    int infer(const std::vector<std::string>& input, LDADoc& doc);
+    // 其中input是分词后字符串的集合, 使用当前线程的推断上下文
+    int infer(const std::vector<std::string>& input, LDADoc& doc) const;
+
+    // 使用指定的推断上下文进行LDA主题推断, 多个线程使用各自的上下文即可并发调用
+    int infer(const std::vector<std::string>& input,
+              LDADoc& doc,
+              InferenceContext& context) const;
 
     // 对input的输入进行SentenceLDA主题推断，输出结果存放在doc中
-    // 其中input是句子的集合
-    int infer(const std::vector<std::vector<std::string>>& input, SLDADoc& doc);
+    // 其中input是句子的集合, 使用当前线程的推断上下文
+    int infer(const std::vector<std::vector<std::string>>& input, SLDADoc& doc) const;
+
+    // 使用指定的推断上下文进行SentenceLDA主题推断
+    int infer(const std::vector<std::vector<std::string>>& input,
+              SLDADoc& doc,
+              InferenceContext& context) const;
     
+    // 使用线程池并行运行num_chains条独立的短采样链对input进行LDA主题推断, 降低单篇文档的延迟
+    // 第0条链在调用线程上运行, 其余链由线程池的空闲线程领取; 调用线程只等待本次调用的各链,
+    // 多个线程可同时调用, 也可在线程池的任务中调用
+    // 每条链完整进行burn-in, 之后只采样(max_iter - burn_in_iter) / num_chains轮(向上取整),
+    // 各链的累积结果合并到doc中, 总的累积轮数与infer相当; doc.num_sweeps()为各链中最大的轮数
+    // 第0条链的随机数种子与infer相同, 其余链的种子由其序号导出, 结果可复现
+    // num_chains不大于1时等同于infer
+    int infer_multi_chain(const std::vector<std::string>& input,
+                          LDADoc& doc,
+                          int num_chains) const;
+
+    // 对input进行LDA主题推断, 返回稀疏及稠密格式的文档主题分布
+    // 配置了result_cache_bytes时, 词id序列相同的输入直接返回缓存的结果
+    int infer_topic_dist(const std::vector<std::string>& input, DocTopicDist& result) const;
+
+    // 对input进行SentenceLDA主题推断, 返回稀疏及稠密格式的文档主题分布
+    // 缓存的键同时包含句子划分
+    int infer_topic_dist(const std::vector<std::vector<std::string>>& input,
+                         DocTopicDist& result) const;
+
+    // 使用线程池对一批文档进行LDA主题推断, 第i篇文档的结果存放在docs[i]中
+    // 调用线程参与推断, 多个线程可同时调用, 互不等待对方的批次完成
+    // 每篇文档的推断结果与单独调用infer完全一致, 不受线程数及batch_interleave_docs影响
+    int infer_batch(const std::vector<std::vector<std::string>>& inputs,
+                    std::vector<LDADoc>& docs) const;
+
+    // 使用线程池对一批文档进行SentenceLDA主题推断
+    int infer_batch(const std::vector<std::vector<std::vector<std::string>>>& inputs,
+                    std::vector<SLDADoc>& docs) const;
+
     // REQUIRE: 总轮数需要大于burn-in迭代轮数, 其中总轮数越大，得到的文档主题分布越平滑
+    // 配置了convergence_tolerance时, 累积主题分布收敛后会在total_iter轮之前提前停止
+    // 实际使用的轮数可通过doc.num_sweeps()获取
     void lda_infer(LDADoc& doc, int burn_in_iter, int total_iter) const;
+
+    void lda_infer(LDADoc& doc,
+                   int burn_in_iter,
+                   int total_iter,
+                   InferenceContext& context) const;
     
     // REQUIRE: 总轮数需要大于burn-in迭代轮数, 其中总轮数越大，得到的文档主题分布越平滑
     void slda_infer(SLDADoc& doc, int burn_in_iter, int total_iter) const;
 
+    void slda_infer(SLDADoc& doc,
+                    int burn_in_iter,
+                    int total_iter,
+                    InferenceContext& context) const;
+
     // 返回模型指针以便获取模型参数
-    inline std::shared_ptr<TopicModel> get_model() {
+    inline std::shared_ptr<TopicModel> get_model() const {
         return _model;
     }
 
+    // 返回Metropolis-Hastings采样器已构建的词级别alias table数量, 其他采样器返回0
+    size_t num_materialized_alias_tables() const {
+        const MHSamplerBase* sampler = dynamic_cast<const MHSamplerBase*>(_sampler.get());
+        return sampler != nullptr ? sampler->num_materialized() : 0;
+    }
+
+    // 返回可复用的LDA文档池, 在线服务可借出文档传给infer, 用完自动归还
+    // 例如: auto doc = engine.lda_doc_pool().acquire(); engine.infer(input, *doc);
+    inline DocumentPool<LDADoc>& lda_doc_pool() const {
+        return _lda_doc_pool;
+    }
+
+    // 返回可复用的SentenceLDA文档池
+    inline DocumentPool<SLDADoc>& slda_doc_pool() const {
+        return _slda_doc_pool;
+    }
+
+    // 返回推断结果缓存, 可用于查询命中次数等统计, 未启用缓存时返回nullptr
+    inline const ResultCache* result_cache() const {
+        return _result_cache.get();
+    }
+
     // 返回模型类型, 指明为LDA还是SetennceLDA
-    ModelType model_type() {
+    ModelType model_type() const {
         return _model->type();
     }
 
 private:
+    // 返回批量推断线程池
+    ThreadPool& thread_pool() const;
+
+    // 将input中的词转换为词id存入ids, 跳过词表外的词
+    void term_ids(const std::vector<std::string>& input, std::vector<int>& ids) const;
+
+    // 由input初始化文档: 以词id序列确定随机数种子, 并为每个词随机分配初始主题
+    // chain为多链推断中的链序号, 非0时由其导出不同的随机数种子
+    void init_doc(const std::vector<std::string>& input,
+                  LDADoc& doc,
+                  InferenceContext& context,
+                  int chain = 0) const;
+
+    // 完成一轮采样后的处理: burn-in之后累积采样结果, 并每隔check_interval轮检查收敛
+    // 已收敛时返回true
+    bool end_sweep(LDADoc& doc,
+                   int num_sweeps,
+                   int burn_in_iter,
+                   InferenceContext& context) const;
+
+    // 对inputs中下标为indices的各篇短文本交错进行LDA主题推断, 结果存放在docs的对应位置
+    // 组内文档同步进行每一轮采样, 达到最大轮数或收敛的文档退出该组
+    void infer_interleaved(const std::vector<std::vector<std::string>>& inputs,
+                           std::vector<LDADoc>& docs,
+                           const size_t* indices,
+                           size_t num_docs) const;
+
+    // 在收敛检查点计算文档累积主题分布与上一个检查点的距离, 并将当前分布存入上下文
+    // checkpoint为burn-in之后的检查点序号, 从0开始, 第0个检查点只记录分布
+    // 距离小于收敛阈值时返回true
+    bool converged(const LDADoc& doc, int checkpoint, InferenceContext& context) const;
+
     // 模型结构指针
     std::shared_ptr<TopicModel> _model;
     // 采样器指针, 作用域仅在InferenceEngine
     std::unique_ptr<Sampler> _sampler;
+    // 批量推断使用的线程数
+    int _infer_threads;
+    // 与文档词id序列一起计算随机数种子的salt
+    uint64_t _seed_salt;
+    // infer接口使用的burn-in轮数和最大迭代轮数
+    int _burn_in_iter;
+    int _max_iter;
+    // 收敛阈值, 不大于0时不做收敛检查
+    float _convergence_tolerance;
+    // 收敛检查的间隔轮数
+    int _check_interval;
+    // 收敛检查使用的分布距离
+    ConvergenceDistance _convergence_distance;
+    // LDA推断时是否按词id分组采样
+    bool _collapse_words;
+    // LDA批量推断时每个线程交错采样的短文本数
+    int _interleave_docs;
+    // 批量及多链推断线程池, 首次调用infer_batch或infer_multi_chain时创建
+    mutable std::unique_ptr<ThreadPool> _thread_pool;
+    mutable std::once_flag _thread_pool_flag;
+    // 在线推断复用的文档对象池
+    mutable DocumentPool<LDADoc> _lda_doc_pool;
+    mutable DocumentPool<SLDADoc> _slda_doc_pool;
+    // 推断结果缓存, 未启用时为空
+    std::unique_ptr<ResultCache> _result_cache;
+    // 由采样器类型及推断配置得到的缓存键salt, 配置不同的引擎不会共用缓存结果
+    uint64_t _cache_salt;
 };
 } // namespace familia
 #endif  // FAMILIA_INFERENCE_ENGINE_H
@@ -8,7 +8,9 @@
 #include <vector>
 #include <unordered_map>
 #include <stdio.h>
+#include <algorithm>
 #include <limits>
+#include <memory>
 
 #include "familia/config.pb.h"
 #include "familia/util.h"
@@ -21,6 +23,48 @@ typedef std::pair<int, int> TopicCount;
 // 多个主题计数构成主题分布 TopicDist = Topic Distribution
 typedef std::vector<TopicCount> TopicDist;
 
+// 二进制word topic模型文件的魔数及版本号
+constexpr char WORD_TOPIC_MAGIC[8] = {'F', 'A', 'M', 'I', 'L', 'I', 'A', '\0'};
+constexpr uint32_t WORD_TOPIC_VERSION = 3;
+
+// 主题数不超过该值时主题id使用uint16_t存储, 否则使用int32_t存储
+constexpr int MAX_NARROW_TOPICS = std::numeric_limits<uint16_t>::max() + 1;
+
+// 二进制word topic模型文件头, 文件整体布局如下(CSR格式), 加载时直接mmap使用无需解析:
+// | header | topic_sum[num_topics] | offsets[vocab_size + 1] |
+// | topic_ids[num_nonzeros] | padding | counts[num_nonzeros] |
+// 其中第i个词的主题计数位于[offsets[i], offsets[i + 1])区间, 且按主题id升序排列
+// topic_ids每个元素占topic_id_bytes字节, 其后补齐至8字节对齐
+// checksum为topic_sum, offsets, topic_ids及counts的校验和, 写入时计算, 加载时无需重新计算
+struct WordTopicHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_topics;
+    uint64_t vocab_size;
+    uint64_t num_nonzeros;
+    uint32_t topic_id_bytes;
+    uint32_t reserved;
+    uint64_t checksum;
+};
+static_assert(sizeof(WordTopicHeader) == 48, "WordTopicHeader must be packed to 48 bytes");
+
+// 某个词的稀疏主题分布, 指向模型内部的连续存储, 主题id按升序排列
+// 主题id根据模型主题数存放于narrow_ids或wide_ids其中之一
+struct WordTopicRow {
+    const uint16_t* narrow_ids;
+    const int32_t* wide_ids;
+    const int32_t* counts;
+    size_t size;
+
+    inline int topic(size_t i) const {
+        return narrow_ids != nullptr ? narrow_ids[i] : wide_ids[i];
+    }
+
+    inline int count(size_t i) const {
+        return counts[i];
+    }
+};
+
 // 主题模型模型存储结构，包含词表和word topic count两分布
 // 其中LDA和SentenceLDA使用同样的模型存储格式
 class TopicModel {
@@ -34,24 +78,117 @@ public:
     }
 
     // 加载word topic count以及词表文件
+    // word topic文件可为文本格式或二进制格式, 根据文件头自动识别
     void load_model(const std::string& word_topic_path, const std::string& vocab_path);
-    
+
+    // 将word topic参数以二进制格式写入文件, 成功返回0
+    int save_binary_word_topic(const std::string& word_topic_path) const;
+
+    // 逐项校验word topic参数, 即主题id有序且在[0, num_topics)内, 计数为正
+    // 且与文件头中的校验和一致, 通过返回true
+    // 需要读取全部非零项, 加载二进制文件时仅在配置validate_word_topic开启时调用
+    bool validate_word_topic() const;
+
+    // 返回模型参数(包括超参数)的校验和, 用于校验依赖于模型的缓存文件
+    // 加载模型时计算一次, 二进制格式直接使用文件头中保存的word topic校验和
+    inline uint64_t checksum() const {
+        return _checksum;
+    }
+
+    // 返回非零项总数
+    inline uint64_t num_nonzeros() const {
+        return _offsets[vocab_size()];
+    }
+
+    // 返回某个词的主题分布在CSR存储中的起始偏移量, 第i个词位于[offset(i), offset(i + 1))
+    inline uint64_t word_topic_offset(int word_id) const {
+        return _offsets[word_id];
+    }
+
+    // 预取词在CSR存储中的偏移量, 之后再调用prefetch_word_topic时不会因读取偏移量而阻塞
+    inline void prefetch_word_offset(int word_id) const {
+        __builtin_prefetch(_offsets + word_id);
+    }
+
+    // 预取词主题分布(主题id及计数)的前MAX_PREFETCH_LINES个缓存行, 以及词的稠密行和phi行索引
+    inline void prefetch_word_topic(int word_id) const {
+        uint64_t begin = _offsets[word_id];
+        uint64_t end = _offsets[word_id + 1];
+        if (_narrow_ids != nullptr) {
+            prefetch_range(_narrow_ids + begin, _narrow_ids + end);
+        } else {
+            prefetch_range(_wide_ids + begin, _wide_ids + end);
+        }
+        prefetch_range(_counts + begin, _counts + end);
+        if (!_dense_row_index.empty()) {
+            __builtin_prefetch(_dense_row_index.data() + word_id);
+        }
+        if (!_phi_row_index.empty()) {
+            __builtin_prefetch(_phi_row_index.data() + word_id);
+        }
+    }
+
     // 返回模型中某个词在某个主题下的参数值，由于模型采用稀疏存储，若找不到则返回0
+    // 对于使用稠密存储的高频词直接按下标返回
     int word_topic(int word_id, int topic_id) const {
-        // 二分查找
-        auto it = std::lower_bound(_word_topic[word_id].begin(), 
-                                   _word_topic[word_id].end(), 
-                                   std::make_pair(topic_id, std::numeric_limits<int>::min()));
-        if (it != _word_topic[word_id].end() && it->first == topic_id) {
-            return it->second;
-        } else {
-            return 0;
+        if (!_dense_row_index.empty() && _dense_row_index[word_id] >= 0) {
+            return _dense_counts[static_cast<size_t>(_dense_row_index[word_id]) * _num_topics
+                                 + topic_id];
         }
+        uint64_t begin = _offsets[word_id];
+        uint64_t end = _offsets[word_id + 1];
+        uint64_t pos = _narrow_ids != nullptr ? find_topic(_narrow_ids, begin, end, topic_id)
+                                              : find_topic(_wide_ids, begin, end, topic_id);
+        return pos != end ? _counts[pos] : 0;
     }
 
     // 返回某个词的主题分布
-    TopicDist& word_topic(int term_id) {
-        return _word_topic.at(term_id);
+    WordTopicRow word_topic(int term_id) const {
+        CHECK_GE(term_id, 0) << "Term id out of range!";
+        CHECK_LT(term_id, vocab_size()) << "Term id out of range!";
+        uint64_t begin = _offsets[term_id];
+        return {_narrow_ids != nullptr ? _narrow_ids + begin : nullptr,
+                _wide_ids != nullptr ? _wide_ids + begin : nullptr,
+                _counts + begin,
+                _offsets[term_id + 1] - begin};
+    }
+
+    // 返回词在某个主题下的归一化概率phi = (word_topic + beta) / (topic_sum + beta_sum)
+    // 已预先计算phi的高频词按下标直接读取, 其他词由计数和预先计算的倒数得到, 均不需要做除法
+    inline float word_topic_prob(int word_id, int topic_id) const {
+        if (!_phi_row_index.empty() && _phi_row_index[word_id] >= 0) {
+            return _phi[static_cast<size_t>(_phi_row_index[word_id]) * _num_topics + topic_id];
+        }
+        if (!_dense_row_index.empty() && _dense_row_index[word_id] >= 0) {
+            int count = _dense_counts[static_cast<size_t>(_dense_row_index[word_id]) * _num_topics
+                                      + topic_id];
+            return (count + _beta) * _inv_topic_denominator[topic_id];
+        }
+        uint64_t begin = _offsets[word_id];
+        uint64_t end = _offsets[word_id + 1];
+        uint64_t pos = _narrow_ids != nullptr ? find_topic(_narrow_ids, begin, end, topic_id)
+                                              : find_topic(_wide_ids, begin, end, topic_id);
+        if (pos == end) {
+            return _beta * _inv_topic_denominator[topic_id];
+        }
+        return (_counts[pos] + _beta) * _inv_topic_denominator[topic_id];
+    }
+
+    // 返回某个词的稠密主题计数(长度为主题数), 若该词未使用稠密存储则返回nullptr
+    inline const int32_t* dense_row(int word_id) const {
+        if (_dense_row_index.empty() || _dense_row_index[word_id] < 0) {
+            return nullptr;
+        }
+        return _dense_counts.data() + static_cast<size_t>(_dense_row_index[word_id]) * _num_topics;
+    }
+
+    // 返回词的稠密phi行(长度为主题数), 与word_topic_prob的结果逐项相同
+    // 若该词未预先计算phi则返回nullptr
+    inline const float* phi_row(int word_id) const {
+        if (_phi_row_index.empty() || _phi_row_index[word_id] < 0) {
+            return nullptr;
+        }
+        return _phi.data() + static_cast<size_t>(_phi_row_index[word_id]) * _num_topics;
     }
 
     // 返回指定topic id的topic sum参数
@@ -62,6 +199,26 @@ public:
         return _topic_sum;
     }
 
+    // 返回log(topic_sum + beta_sum), 用于对数空间的SentenceLDA采样
+    inline double log_topic_denominator(int topic_id) const {
+        return _log_topic_denominator[topic_id];
+    }
+
+    // 返回所有主题的log(topic_sum + beta_sum)
+    inline const std::vector<double>& log_topic_denominator() const {
+        return _log_topic_denominator;
+    }
+
+    // 返回1 / (topic_sum + beta_sum)
+    inline double inv_topic_denominator(int topic_id) const {
+        return _inv_topic_denominator[topic_id];
+    }
+
+    // 返回所有主题的1 / (topic_sum + beta_sum)
+    inline const std::vector<double>& inv_topic_denominator() const {
+        return _inv_topic_denominator;
+    }
+
     inline int num_topics() const {
         return _num_topics;
     }
@@ -91,16 +248,77 @@ public:
     }
 
 private:
-    // 加载word topic参数
+    // 加载文本格式的word topic参数
     void load_word_topic(const std::string& word_topic_path);
-    // word topic 模型参数
-    std::vector<TopicDist> _word_topic;
+    // 文本格式word topic文件中一个分片的解析结果, 每个线程各自持有
+    struct WordTopicChunk {
+        // 每个非零项对应的词id
+        std::vector<int32_t> term_ids;
+        // 每个非零项对应的主题计数
+        std::vector<TopicCount> topic_counts;
+        // 分片内的topic sum
+        std::vector<uint64_t> topic_sum;
+    };
+    // 解析文本格式word topic文件中[begin, end)范围内的所有行
+    void parse_word_topic_chunk(const char* begin, const char* end, WordTopicChunk& chunk) const;
+    // 根据各分片解析出的非零项构建CSR格式的word topic参数
+    void build_word_topic(const std::vector<WordTopicChunk>& chunks);
+    // 通过mmap加载二进制格式的word topic参数, 成功返回0
+    int load_binary_word_topic(const std::string& word_topic_path);
+    // 计算word topic参数(topic_sum及CSR存储)的校验和, 需要读取全部非零项
+    uint64_t compute_word_topic_checksum() const;
+    // 校验每行主题id有序且在[0, num_topics)内, 计数为正
+    template <typename TopicId>
+    bool validate_topic_counts(const TopicId* topic_ids) const;
+    // 为非零项比例不低于threshold的词构建稠密存储, 总内存不超过memory_mb
+    void build_dense_rows(float threshold, int memory_mb);
+    // 按词频从高到低为词预先计算稠密的phi行, 总内存不超过memory_mb
+    void build_phi_rows(int memory_mb);
+    // 在[begin, end)区间内二分查找主题id, 找不到时返回end
+    template<typename T>
+    static inline uint64_t find_topic(const T* ids, uint64_t begin, uint64_t end, int topic_id) {
+        const T* it = std::lower_bound(ids + begin, ids + end, topic_id);
+        return (it != ids + end && *it == topic_id) ? it - ids : end;
+    }
+    // word topic 模型参数, 以CSR格式存储, 指向_mapped_file或以下的本地存储
+    // 主题数不超过MAX_NARROW_TOPICS时使用_narrow_ids, 否则使用_wide_ids
+    const uint64_t* _offsets;
+    const uint16_t* _narrow_ids;
+    const int32_t* _wide_ids;
+    const int32_t* _counts;
+    // 文本格式加载时的本地存储
+    std::vector<uint64_t> _offsets_storage;
+    std::vector<uint16_t> _narrow_ids_storage;
+    std::vector<int32_t> _wide_ids_storage;
+    std::vector<int32_t> _counts_storage;
+    // 二进制格式加载时的文件映射
+    std::unique_ptr<MappedFile> _mapped_file;
+    // 高频词的稠密存储下标, 未使用稠密存储的词为-1; 未启用时为空
+    std::vector<int32_t> _dense_row_index;
+    // 高频词的稠密主题计数, 每个词占连续的num_topics个元素
+    std::vector<int32_t> _dense_counts;
+    // 预先计算phi的词在_phi中的行下标, 未预先计算的词为-1; 未启用时为空
+    std::vector<int32_t> _phi_row_index;
+    // 预先计算的phi值, 布局与稠密存储相同, 每个词占连续的num_topics个元素(包括计数为0的主题)
+    std::vector<float> _phi;
     // word topic对应的每一维主题的计数总和
     std::vector<uint64_t> _topic_sum;
+    // word topic参数的校验和, 文本格式加载后计算, 二进制格式取自文件头
+    uint64_t _word_topic_checksum;
+    // 包含超参数的模型校验和
+    uint64_t _checksum;
+    // 每一维主题的log(topic_sum + beta_sum), 模型加载后预先计算
+    std::vector<double> _log_topic_denominator;
+    // 每一维主题的1 / (topic_sum + beta_sum), 模型加载后预先计算
+    std::vector<double> _inv_topic_denominator;
     // 模型对应的词表数据结构
     Vocab _vocab;
     // 主题数
     int _num_topics;
+    // 加载文本格式模型使用的线程数
+    int _load_threads;
+    // 加载二进制格式模型时是否逐项校验
+    bool _validate_word_topic;
     // 主题模型超参数
     float _alpha;
     float _alpha_sum;
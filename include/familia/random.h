@@ -0,0 +1,40 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef FAMILIA_RANDOM_H
+#define FAMILIA_RANDOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace familia {
+
+// 多路交错的xoshiro256+随机数生成器, 每一路为独立的xoshiro256+序列
+// 状态按路交错存放, 批量生成时各路之间没有依赖, 可以向量化
+// 仅用于生成[0, 1)之间的均匀浮点数, 其最低几位的线性相关性不影响结果
+class Xoshiro256Plus {
+public:
+    // 并行的路数
+    static constexpr int LANES = 4;
+
+    Xoshiro256Plus() {
+        seed(0);
+    }
+
+    // 使用splitmix64将种子扩展为各路的初始状态
+    void seed(uint64_t seed);
+
+    // 向out中写入n个[0, 1)之间的均匀浮点数, 精度为2^-52
+    // REQUIRE: n为LANES的整数倍
+    void fill_uniform(double* out, size_t n);
+
+private:
+    // _state[i][lane]为第lane路的第i个状态字
+    uint64_t _state[4][LANES];
+};
+
+// 返回当前使用的批量生成实现名称
+const char* random_kernel_name();
+} // namespace familia
+#endif  // FAMILIA_RANDOM_H
@@ -0,0 +1,90 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef FAMILIA_RESULT_CACHE_H
+#define FAMILIA_RESULT_CACHE_H
+
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "familia/document.h"
+
+namespace familia {
+
+// 推断结果的LRU缓存, 键为文档词id序列与推断配置的64位哈希值
+// 每个结果同时保存其词id序列, 命中时逐项比较, 哈希冲突的输入按未命中处理
+// 缓存按键分为多个分片, 每个分片有独立的锁和LRU链表, 容量按字节平均分配到各分片
+// 线程安全, 多个线程可同时查询和插入
+class ResultCache {
+public:
+    // capacity_bytes为缓存的总容量, num_shards为分片数
+    ResultCache(size_t capacity_bytes, int num_shards);
+
+    // 查询key对应且词id序列与ids相同的结果, 命中时拷贝到result中并返回true
+    bool lookup(uint64_t key, const std::vector<int>& ids, DocTopicDist& result);
+
+    // 插入key对应的结果, 超出分片容量时淘汰最久未使用的结果
+    // 已有相同key但词id序列不同的结果时以新结果替换; 单个结果大于分片容量时不缓存
+    void insert(uint64_t key, const std::vector<int>& ids, const DocTopicDist& result);
+
+    // 返回命中次数
+    uint64_t hits() const;
+
+    // 返回未命中次数, 包含哈希冲突
+    uint64_t misses() const;
+
+    // 返回key相同但词id序列不同的次数
+    uint64_t collisions() const;
+
+    // 返回缓存的结果数量
+    size_t num_entries() const;
+
+    // 返回缓存结果估计占用的字节数
+    size_t size_bytes() const;
+
+    inline size_t capacity_bytes() const {
+        return _shard_capacity * _shards.size();
+    }
+
+    // no copying allowed
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+private:
+    struct Entry {
+        uint64_t key;
+        std::vector<int> ids;
+        DocTopicDist value;
+        // 结果估计占用的字节数, 包含链表及哈希表节点的开销
+        size_t bytes;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        // 链表头部为最近使用的结果
+        std::list<Entry> lru;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t collisions = 0;
+    };
+
+    inline Shard& shard(uint64_t key) {
+        // 哈希表按键的低位分桶, 分片使用高位以保持两者独立
+        return *_shards[(key >> 32) % _shards.size()];
+    }
+
+    // 估计一个结果在缓存中占用的字节数
+    static size_t entry_bytes(const std::vector<int>& ids, const DocTopicDist& value);
+
+    size_t _shard_capacity;
+    std::vector<std::unique_ptr<Shard>> _shards;
+};
+} // namespace familia
+#endif  // FAMILIA_RESULT_CACHE_H
@@ -6,125 +6,486 @@
 #define FAMILIA_LDA_SAMPLER_H
 
 #include "familia/document.h"
+#include "familia/ftree.h"
+#include "familia/gibbs_kernel.h"
+#include "familia/inference_context.h"
 #include "familia/vose_alias.h"
 #include "familia/model.h"
 #include "familia/util.h"
 
+#include <atomic>
+#include <cmath>
 #include <memory>
 
 namespace familia {
 
-typedef std::vector<int32_t> TopicIndex;
+// alias table缓存文件的魔数及版本号
+constexpr char ALIAS_TABLE_MAGIC[8] = {'F', 'A', 'M', 'I', 'L', 'I', 'A', 'A'};
+constexpr uint32_t ALIAS_TABLE_VERSION = 2;
+
+// alias table缓存文件头, 文件整体布局如下, 加载时直接mmap使用无需拷贝:
+// | header | prob_sum[vocab_size] | beta_entries[num_topics] | word_entries[num_nonzeros] |
+// 表项大小由采样器的主题id类型决定, 类型不一致的文件因大小不匹配而自动失效
+// 第i个词的alias table与模型的CSR存储对齐, 位于[offsets[i], offsets[i + 1])区间
+// 文件通过模型校验和与模型绑定, 模型或超参数变化后自动失效
+struct AliasTableHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_topics;
+    uint64_t vocab_size;
+    uint64_t num_nonzeros;
+    uint64_t model_checksum;
+    double beta_prior_sum;
+};
+static_assert(sizeof(AliasTableHeader) == 48, "AliasTableHeader must be packed to 48 bytes");
 
 // 采样器的接口
 class Sampler {
 public:
     virtual ~Sampler() = default;
 
-    // 对文档进行LDA主题采样
-    virtual void sample_doc(LDADoc& doc) = 0;
+    // 对文档进行LDA主题采样, 随机数及临时缓冲区由context提供
+    // 采样器本身只读, 多个线程使用各自的context即可并发调用
+    virtual void sample_doc(LDADoc& doc, InferenceContext& context) const = 0;
 
     // 对文档进行SentenceLDA主题采样
-    virtual void sample_doc(SLDADoc& doc) = 0;
+    virtual void sample_doc(SLDADoc& doc, InferenceContext& context) const = 0;
+
+    // 按词分组对文档进行LDA主题采样, order为文档中词的下标, 词id相同的下标相邻
+    // 同一个词的模型查找在组内只需进行一次, 每个词的主题仍逐个采样并立即更新文档状态
+    // 默认实现忽略分组, 按文档顺序采样
+    virtual void sample_doc_by_word(LDADoc& doc,
+                                    const std::vector<int>& /*order*/,
+                                    InferenceContext& context) const {
+        sample_doc(doc, context);
+    }
+
+    // 对一组相互独立的文档各进行一轮LDA主题采样, 第k篇文档使用contexts[k]
+    // 实现可交错推进各文档以隐藏访存延迟, 每篇文档的结果与单独调用sample_doc一致
+    // 默认实现逐篇采样
+    virtual void sample_docs(LDADoc* const* docs,
+                             InferenceContext* const* contexts,
+                             size_t num_docs) const {
+        for (size_t k = 0; k < num_docs; ++k) {
+            sample_doc(*docs[k], *contexts[k]);
+        }
+    }
+};
+
+// Metropolis-Hastings采样器中与模板参数无关的接口
+class MHSamplerBase : public Sampler {
+public:
+    // 返回已构建的词级别alias table数量
+    virtual size_t num_materialized() const = 0;
 };
 
 // 基于Metropolis-Hastings的采样器实现，包含LDA和SentenceLDA两个模型的实现
-class MHSampler : public Sampler {
+// MHSteps为每个词(句子)的Metropolis-Hastings步数, 编译期确定以便展开内层循环
+// TopicId为alias table中主题id的存储类型, 主题数不超过MAX_NARROW_TOPICS时可使用uint16_t
+// NOTE: 仅对MHSteps取1~4、TopicId取uint16_t和int32_t进行了实例化
+template <int MHSteps, typename TopicId>
+class MHSampler : public MHSamplerBase {
 public:
-    MHSampler(std::shared_ptr<TopicModel> model) : _model(model) {
-        construct_alias_table();
+    // 若指定了alias table缓存文件且文件有效则直接加载, 否则重新构建并写入缓存文件
+    // lazy为true时每个词的alias table在首次使用时才构建, 此时不使用缓存文件
+    // prefetch_distance大于0时, 采样第i个词时预取第i + prefetch_distance个词的模型数据
+    MHSampler(std::shared_ptr<TopicModel> model,
+              const std::string& alias_table_path = "",
+              bool lazy = false,
+              int prefetch_distance = 0)
+        : _model(model), _lazy(lazy), _prefetch_distance(prefetch_distance),
+          _num_materialized(0) {
+        build_log_word_beta();
+        if (_lazy) {
+            construct_alias_table();
+        } else if (alias_table_path.empty() || load_alias_table(alias_table_path) != 0) {
+            construct_alias_table();
+            if (!alias_table_path.empty()) {
+                save_alias_table(alias_table_path);
+            }
+        }
     }
 
-    void sample_doc(LDADoc& doc) override;
+    void sample_doc(LDADoc& doc, InferenceContext& context) const override;
+
+    void sample_doc(SLDADoc& doc, InferenceContext& context) const override;
+
+    // 同一个词的alias table在组内只解析一次, 出现次数较多的词同时展开其稠密主题计数
+    void sample_doc_by_word(LDADoc& doc,
+                            const std::vector<int>& order,
+                            InferenceContext& context) const override;
+
+    // 各文档按词的位置同步推进, 采样一篇文档的词时按预取距离(至少为1)预取该文档之后的词,
+    // 预取在采样组内其他文档的同时完成
+    void sample_docs(LDADoc* const* docs,
+                     InferenceContext* const* contexts,
+                     size_t num_docs) const override;
 
-    void sample_doc(SLDADoc& doc) override;
+    size_t num_materialized() const override {
+        return _num_materialized.load(std::memory_order_relaxed);
+    }
 
     // no copying allowed
     MHSampler(const MHSampler&) = delete;
     MHSampler& operator=(const MHSampler&) = delete;
 
 private:
-    // 根据LDA模型参数构建alias table
+    static_assert(MHSteps > 0, "MHSteps must be positive");
+
+    typedef BasicAliasEntry<TopicId> Entry;
+
+    // 根据LDA模型参数构建alias table, lazy模式下仅构建先验参数部分
     int construct_alias_table();
 
-    // 对文档中的一个词进行主题采样, 返回采样结果对应的主题ID
-    int sample_token(LDADoc& doc, Token& token);
+    // 构建单个词的alias table
+    void build_word_alias_table(int word_id) const;
+
+    // 预先计算较小词计数c对应的log(c + beta)
+    void build_log_word_beta();
+
+    // 返回log(count + beta), 较小的计数直接查表
+    inline double log_word_beta(int count) const {
+        return count < static_cast<int>(_log_word_beta.size())
+               ? _log_word_beta[count] : std::log(count + static_cast<double>(_model->beta()));
+    }
+
+    // lazy模式下确保词的alias table已构建, 每个词只会被构建一次
+    // 构建完成后的读取只需一次原子读, 不需要加锁
+    inline void ensure_alias_table(int word_id) const {
+        if (_lazy && _alias_states[word_id].load(std::memory_order_acquire) != ALIAS_READY) {
+            materialize_alias_table(word_id);
+        }
+    }
+
+    // 构建词的alias table, 若其他线程正在构建则等待其完成
+    void materialize_alias_table(int word_id) const;
+
+    // 从缓存文件加载alias table, 文件不存在或与模型不匹配时返回-1
+    int load_alias_table(const std::string& alias_table_path);
+
+    // 将alias table写入缓存文件, 成功返回0
+    int save_alias_table(const std::string& alias_table_path) const;
+
+    // 词的alias table(不包含先验部分)及其概率之和, 同一个词的多次出现可复用
+    struct WordAlias {
+        const Entry* entries;
+        size_t size;
+        double prob_sum;
+        // 词的稠密主题计数, 按词分组采样且组内出现次数较多时展开, 否则为nullptr
+        const int32_t* counts;
+    };
+
+    // 组内出现次数不少于该值时展开词的稠密主题计数, 避免每次查询词主题计数时二分查找
+    static constexpr size_t MIN_EXPAND_OCCURRENCES = 4;
+
+    // 返回词的alias table, lazy模式下首次使用时构建
+    inline WordAlias word_alias(int word_id) const {
+        ensure_alias_table(word_id);
+        uint64_t begin = _model->word_topic_offset(word_id);
+        uint64_t end = _model->word_topic_offset(word_id + 1);
+        return {_alias_entries + begin, end - begin, _prob_sum[word_id], nullptr};
+    }
+
+    // 预取词的alias table、概率之和及模型中的词主题分布
+    // REQUIRE: 词的CSR偏移量已预取或已在缓存中, 否则会在读取偏移量时阻塞
+    inline void prefetch_word(int word_id) const {
+        prefetch_range(_alias_entries + _model->word_topic_offset(word_id),
+                       _alias_entries + _model->word_topic_offset(word_id + 1));
+        __builtin_prefetch(_prob_sum + word_id);
+        if (_lazy) {
+            __builtin_prefetch(_alias_states.data() + word_id);
+        }
+        _model->prefetch_word_topic(word_id);
+    }
+
+    // 采样第i个位置的词之前分两级预取之后的词: 第i + 2d个词的CSR偏移量及第i + d个词的模型数据
+    // 其中d为预取距离, order为采样顺序, 为nullptr时按文档顺序; 组内相同词的重复预取开销很小
+    inline void prefetch_ahead(LDADoc& doc, const int* order, size_t i, size_t distance) const {
+        if (i + 2 * distance < doc.size()) {
+            size_t pos = i + 2 * distance;
+            _model->prefetch_word_offset(doc.token(order != nullptr ? order[pos] : pos).id);
+        }
+        if (i + distance < doc.size()) {
+            size_t pos = i + distance;
+            prefetch_word(doc.token(order != nullptr ? order[pos] : pos).id);
+        }
+    }
+
+    // 返回词在主题topic下的计数, 已展开时直接查询稠密计数
+    inline int word_count(const WordAlias& alias, int word_id, int topic) const {
+        return alias.counts != nullptr ? alias.counts[topic] : _model->word_topic(word_id, topic);
+    }
+
+    // 返回词在主题topic下的概率(n_wt + beta) / (n_t + beta_sum)
+    inline float word_prob(const WordAlias& alias, int word_id, int topic) const {
+        return alias.counts != nullptr
+               ? (alias.counts[topic] + _model->beta()) * _model->inv_topic_denominator(topic)
+               : _model->word_topic_prob(word_id, topic);
+    }
+
+    // 对文档中的一个词进行主题采样, 返回采样结果对应的主题ID, alias为该词的alias table
+    int sample_token(LDADoc& doc,
+                     Token& token,
+                     const WordAlias& alias,
+                     InferenceContext& context) const;
 
     // 对文档中的一个句子进行主题采样, 返回采样结果对应的主题ID
-    int sample_sentence(SLDADoc& doc, Sentence& sent);
+    int sample_sentence(SLDADoc& doc, const SentenceView& sent, InferenceContext& context) const;
 
     // doc proposal for LDA
-    int doc_proposal(LDADoc& doc, Token& token);
+    int doc_proposal(LDADoc& doc,
+                     Token& token,
+                     const WordAlias& alias,
+                     InferenceContext& context) const;
 
     // doc proposal for Sentence-LDA
-    int doc_proposal(SLDADoc& doc, Sentence& sent);
+    int doc_proposal(SLDADoc& doc, const SentenceView& sent, InferenceContext& context) const;
 
     // word proposal for LDA
-    int word_proposal(LDADoc& doc, Token& token, int old_topic);
+    int word_proposal(LDADoc& doc,
+                      Token& token,
+                      const WordAlias& alias,
+                      int old_topic,
+                      InferenceContext& context) const;
 
     // word proposal for Sentence-LDA
-    int word_proposal(SLDADoc& doc, Sentence& sent, int old_topic);
+    int word_proposal(SLDADoc& doc,
+                      const SentenceView& sent,
+                      int old_topic,
+                      InferenceContext& context) const;
 
     // propotional function for LDA model
-    float proportional_funtion(LDADoc& doc, Token& token, int new_topic);
+    float proportional_funtion(LDADoc& doc,
+                               Token& token,
+                               const WordAlias& alias,
+                               int new_topic) const;
 
-    // propotional function for SLDA model
-    float proportional_funtion(SLDADoc& doc, Sentence& sent, int new_topic);
+    // 对数空间的SLDA propotional function, 避免长句子连乘导致的下溢
+    double log_proportional_function(SLDADoc& doc, const SentenceView& sent, int new_topic) const;
 
     // word proposal distribuiton for LDA and Sentence-LDA
-    float word_proposal_distribution(int word_id, int topic);
+    float word_proposal_distribution(int word_id, int topic) const;
 
     // doc proposal distribution for LDA and Sentence-LDA
-    float doc_proposal_distribution(LDADoc& doc, int topic);
+    float doc_proposal_distribution(LDADoc& doc, int topic) const;
 
     // 对当前词id的单词使用Metroplis-Hastings方法proprose一个主题id
-    int propose(int word_id);
+    inline int propose(int word_id, InferenceContext& context) const {
+        return propose(word_alias(word_id), context);
+    }
+
+    // 从词的alias table及先验部分中proprose一个主题id
+    int propose(const WordAlias& alias, InferenceContext& context) const;
 
     // LDA model pointer, shared by sampler and inference engine
     std::shared_ptr<TopicModel> _model;
 
-    // 主题的下标映射
-    std::vector<TopicIndex> _topic_indexes;
-
-    // 存放每个单词使用VoseAlias Method构建的alias结果(word-proposal无先验参数部分)
-    std::vector<VoseAlias> _alias_tables;
+    // 所有词的alias table(word-proposal无先验参数部分)存放在同一块连续内存中
+    // 第i个词的表项与模型的CSR存储对齐, 指向_alias_arena或_mapped_file
+    // lazy模式下的构建过程对外不可见, 因此相关成员声明为mutable
+    const Entry* _alias_entries;
+    mutable std::unique_ptr<Entry[]> _alias_arena;
 
     // 存放每个单词各个主题下概率之和(word-proposal无先验参数部分)
-    std::vector<double> _prob_sum;
+    // 指向_prob_sum_storage或_mapped_file
+    const double* _prob_sum;
+    mutable std::vector<double> _prob_sum_storage;
+
+    // 从缓存文件加载时的文件映射
+    MappedFile _mapped_file;
+
+    // lazy模式下每个词alias table的构建状态
+    enum AliasState : uint8_t {
+        ALIAS_EMPTY = 0,
+        ALIAS_BUILDING = 1,
+        ALIAS_READY = 2
+    };
+    mutable std::vector<std::atomic<uint8_t>> _alias_states;
+
+    // 是否在首次使用时才构建词的alias table
+    bool _lazy;
 
-    // 存放先验参数部分使用VoseAlias Method构建的alias结果(word-proposal先验参数部分)
-    VoseAlias _beta_alias;
+    // 软件预取的距离(词数), 为0时不预取
+    int _prefetch_distance;
+
+    // 已构建的词级别alias table数量
+    mutable std::atomic<size_t> _num_materialized;
+
+    // 存放先验参数部分的压缩格式alias table(word-proposal先验参数部分)
+    std::vector<Entry> _beta_alias;
     
     // 存放先验参数各个主题下概率之和(word-proposal先验参数部分)
     double _beta_prior_sum;
 
-    // Metropolis-Hastings steps, 默认值为2
-    static constexpr int _mh_steps = 2;
+    // 较小词计数c对应的log(c + beta)
+    std::vector<double> _log_word_beta;
 };
 
+extern template class MHSampler<1, uint16_t>;
+extern template class MHSampler<2, uint16_t>;
+extern template class MHSampler<3, uint16_t>;
+extern template class MHSampler<4, uint16_t>;
+extern template class MHSampler<1, int32_t>;
+extern template class MHSampler<2, int32_t>;
+extern template class MHSampler<3, int32_t>;
+extern template class MHSampler<4, int32_t>;
+
 // 吉布斯采样器，实现了LDA和SentenceLDA两种模型的采样算法
 class GibbsSampler : public Sampler {
 public:
-    GibbsSampler(std::shared_ptr<TopicModel> model) : _model(model) {
-    }
+    GibbsSampler(std::shared_ptr<TopicModel> model);
 
     // 对文档输入进行LDA主题采样，主题结果保存在doc中
-    void sample_doc(LDADoc& doc) override;
+    void sample_doc(LDADoc& doc, InferenceContext& context) const override;
 
     // 使用SentenceLDA模型对文档每个句子进行采样, 结果保存在doc中
-    // 其中SentenceLDA采样算法考虑了数值计算的精度问题，对公式进行了采样
-    void sample_doc(SLDADoc& doc) override;
+    // 条件概率在对数空间中计算, 句子较长时也不会下溢
+    void sample_doc(SLDADoc& doc, InferenceContext& context) const override;
+
+    // 同一个词的稠密主题计数在组内只展开一次, 各主题的条件概率随文档主题计数的变化增量更新
+    void sample_doc_by_word(LDADoc& doc,
+                            const std::vector<int>& order,
+                            InferenceContext& context) const override;
 
     // no copying allowed
     GibbsSampler(const GibbsSampler&) = delete;
     GibbsSampler& operator=(const GibbsSampler&) = delete;
 
 private:
-    int sample_token(LDADoc& doc, Token& token);
+    int sample_token(LDADoc& doc, Token& token, InferenceContext& context) const;
+
+    // 对与前一个词相同的词进行主题采样, prob为该词在当前文档状态下未扣除自身计数的各主题概率
+    int sample_repeated_token(LDADoc& doc,
+                              int old_topic,
+                              const int32_t* word_counts,
+                              std::vector<float>& prob,
+                              InferenceContext& context) const;
+
+    int sample_sentence(SLDADoc& doc, const SentenceView& sent, InferenceContext& context) const;
+
+    // 返回主题topic未扣除当前词自身计数的条件概率, 与gibbs_token_prob逐元素的结果相同
+    // 由gibbs_topic_prob在不使用-ffast-math的编译单元中计算, 不能在此处内联展开
+    inline float token_prob(const LDADoc& doc, const int32_t* word_counts, int topic) const {
+        return gibbs_topic_prob(doc.topic_sum(topic), word_counts[topic],
+                                _inv_topic_denominator[topic], _model->alpha(), _model->beta());
+    }
+
+    // 返回词的稠密主题计数, 使用稠密存储的词直接返回, 否则展开至context的计数缓冲区
+    const int32_t* expand_word_topic(int word_id, InferenceContext& context) const;
+
+    // 清除expand_word_topic在计数缓冲区中写入的内容
+    void clear_word_topic(int word_id, InferenceContext& context) const;
+
+    // 在累积概率中查找第一个不小于dart的位置, 即采样得到的主题id
+    static int search_topic(const std::vector<float>& accum_prob, int num_topics, double dart);
+
+    std::shared_ptr<TopicModel> _model;
+
+    // 各主题的1 / (topic_sum + beta_sum)
+    std::vector<float> _inv_topic_denominator;
+
+    // 各主题的log(topic_sum + beta_sum)
+    std::vector<float> _log_topic_denominator;
+
+    // 较小词计数c对应的log(c + beta) - log(beta), 避免逐非零项调用log
+    std::vector<float> _log_word_count;
+    // 较小文档主题计数c对应的log(c + alpha) - log(alpha)
+    std::vector<float> _log_doc_count;
+    static constexpr int _log_table_size = 4096;
+};
+
+// 基于SparseLDA分桶方法的吉布斯采样器, 与GibbsSampler采样自相同的条件分布
+// 将除当前主题外各主题的条件概率拆分为平滑项、文档项和词项三个桶:
+//   (n_dt + alpha)(n_wt + beta) / D_t
+//       = alpha * beta / D_t + n_dt * beta / D_t + (n_dt + alpha) * n_wt / D_t
+// 其中D_t = n_t + beta_sum, 推断时模型参数固定, 因此平滑项预先计算, 文档项随文档主题计数增量更新
+// 每个词的采样代价与文档主题分布及词主题分布的非零项数量成正比
+// 当前主题需扣除自身计数, 单独作为一项精确计算
+// SentenceLDA的条件概率无法按上述方式拆分, 仍使用精确的吉布斯采样
+class SparseGibbsSampler : public Sampler {
+public:
+    explicit SparseGibbsSampler(std::shared_ptr<TopicModel> model);
+
+    void sample_doc(LDADoc& doc, InferenceContext& context) const override;
+
+    void sample_doc(SLDADoc& doc, InferenceContext& context) const override;
+
+    // no copying allowed
+    SparseGibbsSampler(const SparseGibbsSampler&) = delete;
+    SparseGibbsSampler& operator=(const SparseGibbsSampler&) = delete;
+
+private:
+    // 对文档中的一个词进行主题采样, doc_topics为文档中计数非零的主题
+    // doc_bucket_sum为文档项之和(包含当前主题)
+    int sample_token(LDADoc& doc,
+                     Token& token,
+                     const std::vector<int>& doc_topics,
+                     double doc_bucket_sum,
+                     InferenceContext& context) const;
+
+    std::shared_ptr<TopicModel> _model;
 
-    int sample_sentence(SLDADoc& doc, Sentence& sent);
+    // SentenceLDA使用的精确吉布斯采样器
+    GibbsSampler _exact_sampler;
+
+    // 各主题的1 / D_t
+    std::vector<double> _inv_denominator;
+
+    // 平滑项alpha * beta / D_t的前缀和, 长度为主题数 + 1
+    std::vector<double> _smoothing_prefix;
+};
+
+// 基于F+树的吉布斯采样器, 与GibbsSampler采样自相同的条件分布
+// 将除当前主题外各主题的条件概率拆分为稠密的先验项和稀疏的词项:
+//   (n_dt + alpha)(n_wt + beta) / D_t = (n_dt + alpha) * beta / D_t + (n_dt + alpha) * n_wt / D_t
+// 先验项存放于F+树中, 文档主题计数变化时以O(log K)更新, 采样同样为O(log K)
+// 词项只需顺序扫描词在CSR存储中的连续非零项, 每步访问的缓存行少于MHSampler
+// 当前主题单独精确计算; SentenceLDA仍使用精确的吉布斯采样
+class FTreeSampler : public Sampler {
+public:
+    explicit FTreeSampler(std::shared_ptr<TopicModel> model);
+
+    void sample_doc(LDADoc& doc, InferenceContext& context) const override;
+
+    void sample_doc(SLDADoc& doc, InferenceContext& context) const override;
+
+    // no copying allowed
+    FTreeSampler(const FTreeSampler&) = delete;
+    FTreeSampler& operator=(const FTreeSampler&) = delete;
+
+private:
+    // 对文档中的一个词进行主题采样, 调用时F+树中当前主题的权重需已置为0
+    int sample_token(LDADoc& doc, Token& token, const FTree& tree, InferenceContext& context) const;
+
+    // 将上下文中的F+树同步为文档当前的主题计数
+    // 只更新上一次同步以来计数可能变化的主题, 复杂度与文档长度相关而与主题数无关;
+    // 上下文首次使用或上次由其他采样器使用时才需O(K)构建
+    void sync_tree(const LDADoc& doc, FTreeState& state) const;
+
+    // 返回文档主题计数为count时主题在F+树中的先验项权重
+    inline double prior_weight(size_t count, int topic) const {
+        return (count + _model->alpha()) * _beta_inv_denominator[topic];
+    }
+
+    // 将F+树中主题的叶子节点更新为计数count对应的权重
+    inline void update_leaf(FTreeState& state, int topic, int count) const {
+        state.counts[topic] = count;
+        state.tree.update(topic, prior_weight(count, topic));
+    }
 
     std::shared_ptr<TopicModel> _model;
+
+    // 采样器的唯一标识, 用于判断上下文中的F+树是否由本采样器构建
+    uint64_t _id;
+
+    // SentenceLDA使用的精确吉布斯采样器
+    GibbsSampler _exact_sampler;
+
+    // 各主题的1 / D_t
+    std::vector<double> _inv_denominator;
+
+    // 各主题的beta / D_t
+    std::vector<double> _beta_inv_denominator;
 };
 } // namespace familia
 #endif  // FAMILIA_SAMPLER_H
@@ -0,0 +1,76 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef FAMILIA_THREAD_POOL_H
+#define FAMILIA_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace familia {
+
+// 线程池, 工作线程在整个生命周期内常驻
+// 每次parallel_for调用构成一个批次, 批次内的下标由参与的线程按顺序动态领取,
+// 从而使长短不一的任务自动在各线程间均衡
+// 调用线程同样参与执行本批次的任务, 并只等待本批次完成: 多个线程可同时调用parallel_for,
+// 空闲的工作线程在各批次之间轮流服务; 任务内部也可以再调用parallel_for, 不会死锁
+class ThreadPool {
+public:
+    // num_threads为参与计算的线程总数(包含调用线程), 为0时使用全部CPU核
+    explicit ThreadPool(int num_threads);
+
+    ~ThreadPool();
+
+    // 返回参与计算的线程总数, 包含调用parallel_for的线程
+    inline int num_threads() const {
+        return static_cast<int>(_threads.size()) + 1;
+    }
+
+    // 对[0, n)内的每个下标调用一次func(index, worker_id), 阻塞直至本次调用的全部下标完成
+    // 下标0总是由调用线程执行, 其余下标由调用线程及空闲的工作线程领取
+    // 工作线程的worker_id在[0, num_threads() - 1)内, 调用线程执行的任务worker_id为-1
+    void parallel_for(size_t n, const std::function<void(size_t, int)>& func);
+
+    // no copying allowed
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+private:
+    // 一次parallel_for调用, 存放在调用线程的栈上
+    struct Batch {
+        const std::function<void(size_t, int)>* func;
+        size_t size;
+        // 下一个待领取的下标
+        std::atomic<size_t> next;
+        // 正在执行本批次任务的工作线程数
+        std::atomic<int> workers;
+        std::mutex mutex;
+        std::condition_variable done_cv;
+    };
+
+    // 工作线程主循环
+    void worker_loop(int worker_id);
+
+    // 领取并执行batch中的任务, 直至所有下标均已被领取
+    static void run_batch(Batch& batch, int worker_id);
+
+    // 将batch从待服务的批次中移除, 之后不会再有工作线程开始执行它
+    void remove_batch(Batch* batch);
+
+    std::vector<std::thread> _threads;
+    // 保护_batches及_stop
+    std::mutex _mutex;
+    std::condition_variable _work_cv;
+    // 尚有下标未被领取的批次, 工作线程按顺序轮流服务
+    std::deque<Batch*> _batches;
+    bool _stop;
+};
+} // namespace familia
+#endif // FAMILIA_THREAD_POOL_H
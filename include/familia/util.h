@@ -5,9 +5,9 @@
 #ifndef FAMILIA_UTIL_H
 #define FAMILIA_UTIL_H
 
-#include <atomic>
+#include <cstring>
 #include <ctime>
-#include <random>
+#include <limits>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -16,41 +16,6 @@
 
 namespace familia {
 
-// 返回一个可在多线程下工作的随机数引擎
-inline std::mt19937& local_random_engine() {
-    struct engine_wrapper_t {
-        std::mt19937 engine;
-        engine_wrapper_t() {
-            static std::atomic<unsigned long> x(0);
-            std::seed_seq sseq = {x++, x++, x++, x++};
-            engine.seed(sseq);
-        }
-    };
-    static engine_wrapper_t r;
-    return r.engine;
-}
-
-// 固定随机种子并重置分布
-inline void fix_random_seed(int seed = 2147483647) {
-    auto& engine = local_random_engine();
-    engine.seed(seed);
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0); 
-    distribution.reset(); // 重置分布，使下一次从分布中生成的样本不依赖过去的生成的状态
-}
-
-// 返回min~max之间的随机浮点数, 默认返回0~1的浮点数
-inline double rand(double min = 0.0, double max = 1.0) {
-    auto& engine = local_random_engine();
-    static std::uniform_real_distribution<double> distribution(min, max);
-
-    return distribution(engine);
-}
-
-// 返回[0, k - 1]之间的整型浮点数
-inline int rand_k(int k) {
-    return static_cast<int>(rand(0.0, 1.0) * k);
-}
-
 template<typename T>
 int load_prototxt(const std::string& config_file, T& proto) {
     LOG(INFO) << "Loading prototxt: " << config_file;
@@ -84,5 +49,94 @@ int load_prototxt(const std::string& config_file, T& proto) {
 // 简单版本的split函数, 按照分隔符进行分割
 void split(std::vector<std::string>& result, const std::string& text, char separator);
 
+// 软件预取使用的缓存行大小, 以及单次prefetch_range最多预取的缓存行数
+constexpr size_t CACHE_LINE_SIZE = 64;
+constexpr size_t MAX_PREFETCH_LINES = 4;
+
+// 预取[begin, end)所在的缓存行, 较长的区间只预取前MAX_PREFETCH_LINES行
+template<typename T>
+inline void prefetch_range(const T* begin, const T* end) {
+    const char* ptr = reinterpret_cast<const char*>(begin);
+    const char* last = reinterpret_cast<const char*>(end);
+    for (size_t i = 0; i < MAX_PREFETCH_LINES && ptr < last; ++i, ptr += CACHE_LINE_SIZE) {
+        __builtin_prefetch(ptr);
+    }
+}
+
+// MurmurHash64A, 用于计算模型校验和等场景
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (size * m);
+    const unsigned char* ptr = static_cast<const unsigned char*>(data);
+    const unsigned char* end = ptr + (size & ~static_cast<size_t>(7));
+    for (; ptr != end; ptr += 8) {
+        uint64_t k;
+        memcpy(&k, ptr, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    size_t remain = size & 7;
+    if (remain > 0) {
+        uint64_t k = 0;
+        memcpy(&k, ptr, remain);
+        h ^= k;
+        h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+// 从ptr开始解析一个非负十进制整数, 解析成功后ptr指向数字之后的第一个字符
+// 不分配内存, 用于模型文件的快速解析; 没有数字或溢出时返回false
+inline bool parse_uint(const char*& ptr, const char* end, int& value) {
+    const char* begin = ptr;
+    int64_t result = 0;
+    while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+        result = result * 10 + (*ptr - '0');
+        if (result > std::numeric_limits<int>::max()) {
+            return false;
+        }
+        ++ptr;
+    }
+    value = static_cast<int>(result);
+    return ptr != begin;
+}
+
+// 以只读方式将文件映射至内存, 映射同一文件的多个进程共享page cache
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    ~MappedFile();
+
+    // 映射文件, 成功返回0, 失败返回-1; 空文件映射成功, 此时size()为0
+    int open(const std::string& path);
+
+    // 解除文件映射
+    void close();
+
+    inline const char* data() const {
+        return _data;
+    }
+
+    inline size_t size() const {
+        return _size;
+    }
+
+    // no copying allowed
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+private:
+    const char* _data = nullptr;
+    size_t _size = 0;
+};
+
 } // namespace familia
 #endif // FAMILIA_UTIL_H
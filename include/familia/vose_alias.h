@@ -10,32 +10,42 @@
 #include "familia/util.h"
 
 namespace familia {
-// Vose's Alias Method 数值稳定版本实现
-// 更多的具体细节可以参考 http://www.keithschwarz.com/darts-dice-coins/
-class VoseAlias {
-public:
-    VoseAlias() = default;
-
-    // 根据输入分布初始化alias table
-    void initialize(const std::vector<double>& distribution);
-
-    // 从给定分布中生成采样样本
-    int generate() const;
+// 压缩格式的alias table表项, 一个桶的概率、主题id以及alias对应的主题id存放在一起
+// 生成一个样本只需访问一个表项, 主题数不超过MAX_NARROW_TOPICS时主题id可使用uint16_t存储
+template <typename TopicId>
+struct BasicAliasEntry {
+    float prob; // 命中当前桶自身的概率
+    TopicId topic; // 当前桶对应的主题id
+    TopicId alias_topic; // alias桶对应的主题id
+};
+typedef BasicAliasEntry<int32_t> AliasEntry;
+typedef BasicAliasEntry<uint16_t> NarrowAliasEntry;
+static_assert(sizeof(AliasEntry) == 12, "AliasEntry must be packed to 12 bytes");
+static_assert(sizeof(NarrowAliasEntry) == 8, "NarrowAliasEntry must be packed to 8 bytes");
 
-    // 离散分布的维度
-    inline size_t size() const {
-        return _prob.size();
+// 使用Vose's Alias Method的数值稳定版本, 根据输入分布构建压缩格式的alias table
+// 更多的具体细节可以参考 http://www.keithschwarz.com/darts-dice-coins/
+// 结果写入entries[0, distribution.size())
+// 其中topics[i]为第i个桶对应的主题id, 为nullptr时主题id即为桶下标
+// 仅对AliasEntry和NarrowAliasEntry进行了实例化
+template <typename TopicId>
+void build_alias_entries(const std::vector<double>& distribution,
+                         const int32_t* topics,
+                         BasicAliasEntry<TopicId>* entries);
+
+// 使用[0, 1)之间的随机数rand_value从压缩格式的alias table中生成一个主题id
+// 随机数放大后的整数部分选择桶, 小数部分决定是否使用alias
+template <typename TopicId>
+inline int sample_alias_entries(const BasicAliasEntry<TopicId>* entries,
+                                size_t size,
+                                double rand_value) {
+    double dart = rand_value * size;
+    size_t bucket = static_cast<size_t>(dart);
+    if (bucket >= size) {
+        bucket = size - 1;
     }
-
-    // no copying alowed
-    VoseAlias(const VoseAlias&) = delete;
-    VoseAlias& operator=(const VoseAlias&) = delete;
-
-private:
-    // alias table
-    std::vector<int> _alias;
-    // probability table
-    std::vector<double> _prob;
-};
+    const BasicAliasEntry<TopicId>& entry = entries[bucket];
+    return dart - bucket < entry.prob ? entry.topic : entry.alias_topic;
+}
 } // namespace familia
 #endif // FAMILIA_VOSE_ALIAS_H
@@ -41,9 +41,16 @@ static PyObject* init_inference_engine(PyObject* self, PyObject* args) {
 
     InferenceEngine* engine;
     // sampler_type : 0表示使用GibbsSampling采样方法，1表示使用MetropolisHastings采样方法
+    // 2表示使用SparseGibbsSampling采样方法，3表示使用FTreeSampling采样方法
     if (sampler_type == 1) {
         engine = new InferenceEngine(model_dir, conf, SamplerType::MetropolisHastings);
     }
+    else if (sampler_type == 2) {
+        engine = new InferenceEngine(model_dir, conf, SamplerType::SparseGibbsSampling);
+    }
+    else if (sampler_type == 3) {
+        engine = new InferenceEngine(model_dir, conf, SamplerType::FTreeSampling);
+    }
     else {
         engine = new InferenceEngine(model_dir, conf, SamplerType::GibbsSampling);
     }
@@ -169,12 +176,12 @@ static PyObject* lda_infer(PyObject* self, PyObject* args) {
     // 词与词之间使用空格隔开
     split(input_vec, str, ' ');
 
-    LDADoc doc;
     InferenceEngine* inference_engine = (InferenceEngine*)(infer_ptr);
-    inference_engine->infer(input_vec, doc);
-    vector<Topic> topics;
+    // 启用结果缓存时重复的输入直接返回缓存结果
+    DocTopicDist result;
+    inference_engine->infer_topic_dist(input_vec, result);
     // 使用稀疏结果保存主题分布便于展现
-    doc.sparse_topic_dist(topics);
+    const vector<Topic>& topics = result.sparse;
     //infer后的结果封装成python的list并返回
     PyObject* py_list = PyList_New(0);
     if (py_list != NULL) {
@@ -187,6 +194,27 @@ static PyObject* lda_infer(PyObject* self, PyObject* args) {
     return py_list;
 }
 
+// 返回推断结果缓存的统计, 未启用缓存时返回None
+static PyObject* cache_stats(PyObject* self, PyObject* args) {
+    UNUSED(self);
+    unsigned long infer_ptr = 0;
+    if (!PyArg_ParseTuple(args, "k", &infer_ptr)) {
+        LOG(ERROR) << "Failed to parse cache_stats parameters.";
+        return NULL;
+    }
+    InferenceEngine* inference_engine = (InferenceEngine*)(infer_ptr);
+    const ResultCache* cache = inference_engine->result_cache();
+    if (cache == NULL) {
+        Py_RETURN_NONE;
+    }
+    return Py_BuildValue("{s:K,s:K,s:K,s:n,s:n}",
+                         "hits", (unsigned long long)cache->hits(),
+                         "misses", (unsigned long long)cache->misses(),
+                         "collisions", (unsigned long long)cache->collisions(),
+                         "entries", (Py_ssize_t)cache->num_entries(),
+                         "bytes", (Py_ssize_t)cache->size_bytes());
+}
+
 // 使用SentenceLDA模型对输入的分词文本进行infer
 static PyObject* slda_infer(PyObject* self, PyObject* args) {
     UNUSED(self);
@@ -209,11 +237,10 @@ static PyObject* slda_infer(PyObject* self, PyObject* args) {
         sentences.push_back(sent);
     }
 
-    SLDADoc doc;
     InferenceEngine* inference_engine = (InferenceEngine*)(infer_ptr);
-    inference_engine->infer(sentences, doc);
-    vector<Topic> topics;
-    doc.sparse_topic_dist(topics);
+    DocTopicDist result;
+    inference_engine->infer_topic_dist(sentences, result);
+    const vector<Topic>& topics = result.sparse;
     //infer后的结果封装成python的list并返回
     PyObject* py_list = PyList_New(0);
     if (py_list != NULL) {
@@ -244,16 +271,17 @@ static PyObject* cal_doc_distance(PyObject* self, PyObject* args) {
     split(doc2_tokens, doc_text2, ' ');
 
     // 文档主题推断, 输入分词结果，主题推断结果存放于LDADoc中
-    LDADoc doc1, doc2;
-    inference_engine->infer(doc1_tokens, doc1);
-    inference_engine->infer(doc2_tokens, doc2);
+    auto doc1 = inference_engine->lda_doc_pool().acquire();
+    auto doc2 = inference_engine->lda_doc_pool().acquire();
+    inference_engine->infer(doc1_tokens, *doc1);
+    inference_engine->infer(doc2_tokens, *doc2);
 
     // 计算jsd需要传入稠密型分布
     // 获取稠密的文档主题分布
     vector<float> dense_dist1;
     vector<float> dense_dist2;
-    doc1.dense_topic_dist(dense_dist1);
-    doc2.dense_topic_dist(dense_dist2);
+    doc1->dense_topic_dist(dense_dist1);
+    doc2->dense_topic_dist(dense_dist2);
 
     // 计算分布之间的距离, 值越小则表示文档语义相似度越高
     float jsd = SemanticMatching::jensen_shannon_divergence(dense_dist1, dense_dist2);
@@ -294,10 +322,10 @@ static PyObject* cal_query_doc_similarity(PyObject* self, PyObject* args) {
     split(doc_tokens, document, ' ');
 
     // 对长文本进行主题推断，获取主题分布
-    LDADoc doc;
-    inference_engine->infer(doc_tokens, doc);
+    auto doc = inference_engine->lda_doc_pool().acquire();
+    inference_engine->infer(doc_tokens, *doc);
     vector<Topic> doc_topic_dist;
-    doc.sparse_topic_dist(doc_topic_dist);
+    doc->sparse_topic_dist(doc_topic_dist);
 
     // 计算在LDA跟TWE模型上的相关性
     float lda_sim = SemanticMatching::likelihood_based_similarity(q_tokens,
@@ -335,10 +363,10 @@ static PyObject* cal_keywords_similarity(PyObject* self, PyObject* args) {
     split(word_tokens, words, ' ');
     split(doc_tokens, document, ' ');
 
-    LDADoc doc;
-    inference_engine->infer(doc_tokens, doc);
+    auto doc = inference_engine->lda_doc_pool().acquire();
+    inference_engine->infer(doc_tokens, *doc);
     vector<Topic> doc_topic_dist;
-    doc.sparse_topic_dist(doc_topic_dist);
+    doc->sparse_topic_dist(doc_topic_dist);
 
     vector<WordAndDis> items;
     for (auto word : word_tokens) {
@@ -382,10 +410,10 @@ static PyObject* cal_keywords_twe_similarity(PyObject* self, PyObject* args) {
     split(word_tokens, words, ' ');
     split(doc_tokens, document, ' ');
 
-    LDADoc doc;
-    inference_engine->infer(doc_tokens, doc);
+    auto doc = inference_engine->lda_doc_pool().acquire();
+    inference_engine->infer(doc_tokens, *doc);
     vector<Topic> doc_topic_dist;
-    doc.sparse_topic_dist(doc_topic_dist);
+    doc->sparse_topic_dist(doc_topic_dist);
 
     vector<WordAndDis> items;
     for (auto word : word_tokens) {
@@ -492,6 +520,7 @@ static PyMethodDef Methods[] = {
     {"tokenize", (PyCFunction)tokenize, METH_VARARGS, "tokenize"},
     {"lda_infer", (PyCFunction)lda_infer, METH_VARARGS, "lda_infer"},
     {"slda_infer", (PyCFunction)slda_infer, METH_VARARGS, "slda_infer"},
+    {"cache_stats", (PyCFunction)cache_stats, METH_VARARGS, "result cache statistics"},
     {"cal_doc_distance", (PyCFunction)cal_doc_distance,
         METH_VARARGS, "calculate the distance between two documents"},
     {"cal_query_doc_similarity", (PyCFunction)cal_query_doc_similarity,
@@ -96,6 +96,16 @@ class InferenceEngineWrapper:
         seg_text = seg_text.strip()
         return familia.slda_infer(self._inference_engine, seg_text)
 
+    def cache_stats(self):
+        """推断结果缓存统计
+
+        Returns:
+            未启用缓存(result_cache_bytes为0)时返回None, 否则返回一个dict对象
+            包含hits, misses, collisions, entries, bytes, 其中collisions为
+            哈希值相同但词序列不同的次数, 这些查询按未命中处理。
+        """
+        return familia.cache_stats(self._inference_engine)
+
     def cal_doc_distance(self, doc1, doc2):
         """计算长文本与长文本之间的距离
 
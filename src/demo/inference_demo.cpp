@@ -49,10 +49,11 @@ int main(int argc, char* argv[]) {
         vector<string> input;
         tokenizer->tokenize(line, input);
         if (engine.model_type() == ModelType::LDA) {
-            LDADoc doc;
-            engine.infer(input, doc);
+            // 从文档池借出文档, 复用其内存, 离开作用域时自动归还
+            auto doc = engine.lda_doc_pool().acquire();
+            engine.infer(input, *doc);
             vector<Topic> topics;
-            doc.sparse_topic_dist(topics);
+            doc->sparse_topic_dist(topics);
             print_doc_topic_dist(topics);
         } else if (engine.model_type() == ModelType::SLDA) {
             vector<string> sent;
@@ -71,10 +72,10 @@ int main(int argc, char* argv[]) {
                 sentences.push_back(sent);
             }
 
-            SLDADoc doc;
-            engine.infer(sentences, doc);
+            auto doc = engine.slda_doc_pool().acquire();
+            engine.infer(sentences, *doc);
             vector<Topic> topics;
-            doc.sparse_topic_dist(topics);
+            doc->sparse_topic_dist(topics);
             print_doc_topic_dist(topics);
             sentences.clear();
         }
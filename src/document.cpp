@@ -12,11 +12,32 @@ namespace familia {
 
 // -------------LDA Begin---------------
 void LDADoc::init(int num_topics) {
+    if (num_topics == _num_topics
+        && _tokens.size() * SPARSE_DOC_TOPIC_RATIO < static_cast<size_t>(_num_topics)) {
+        // 上一篇文档为短文本, 只需清除其各个词所在主题的计数
+        for (const auto& token : _tokens) {
+            _topic_sum[token.topic] = 0;
+        }
+    } else {
+        _topic_sum.assign(num_topics, 0);
+    }
     _num_topics = num_topics;
-    _num_accum = 0; // 清空采样累积次数
     _tokens.clear();
-    _topic_sum.resize(_num_topics, 0);
-    _accum_topic_sum.resize(_num_topics, 0);
+    reset_accum_topic_sum(num_topics);
+}
+
+void LDADoc::reset_accum_topic_sum(int num_topics) {
+    _num_accum = 0; // 清空采样累积次数
+    _num_sweeps = 0;
+    if (_sparse_accum && _accum_topic_sum.size() == static_cast<size_t>(num_topics)) {
+        for (int t : _accum_topics) {
+            _accum_topic_sum[t] = 0;
+        }
+    } else {
+        _accum_topic_sum.assign(num_topics, 0);
+    }
+    _accum_topics.clear();
+    _sparse_accum = false;
 }
 
 void LDADoc::add_token(const Token& token) {
@@ -41,18 +62,24 @@ void LDADoc::set_topic(int index, int new_topic) {
 void LDADoc::sparse_topic_dist(vector<Topic>& topic_dist, bool sort) const {
     topic_dist.clear();
     size_t sum = 0;
-    for (int i = 0; i < _num_topics; ++i) {
-        sum += _accum_topic_sum[i];
+    for (size_t i = 0; i < num_accum_topics(); ++i) {
+        sum += _accum_topic_sum[accum_topic(i)];
     }
     if (sum == 0) { 
         return; // 返回空结果
     }
-    for (int i = 0; i < _num_topics; ++i) {
+    for (size_t i = 0; i < num_accum_topics(); ++i) {
+        int t = accum_topic(i);
         // 跳过0的的项，得到稀疏主题分布
-        if (_accum_topic_sum[i] == 0) {
+        if (_accum_topic_sum[t] == 0) {
             continue;
         }
-        topic_dist.push_back({i, _accum_topic_sum[i] * 1.0 / sum});
+        topic_dist.push_back({t, _accum_topic_sum[t] * 1.0 / sum});
+    }
+    if (_sparse_accum) {
+        // 短文本的主题按首次出现顺序排列, 先恢复为按主题id升序
+        std::sort(topic_dist.begin(), topic_dist.end(),
+                  [](const Topic& a, const Topic& b) { return a.tid < b.tid; });
     }
     if (sort) {
         std::sort(topic_dist.begin(), topic_dist.end());
@@ -62,49 +89,111 @@ void LDADoc::sparse_topic_dist(vector<Topic>& topic_dist, bool sort) const {
 void LDADoc::dense_topic_dist(vector<float>& dense_dist) const {
     dense_dist.clear();
     dense_dist.resize(_num_topics, 0.0);
-    // 若文档长度为0，则范围0向量
-    if (size() == 0) {
+    // 每轮采样的计数之和即为文档长度(LDA为词数, SentenceLDA为句子数)
+    size_t sum = 0;
+    for (size_t i = 0; i < num_accum_topics(); ++i) {
+        sum += _accum_topic_sum[accum_topic(i)];
+    }
+    // 若文档长度为0或尚未累积采样结果，则返回0向量
+    if (sum == 0) {
         return;
     }
+    double length = sum * 1.0 / _num_accum;
     for (int i = 0; i < _num_topics; ++i) {
         dense_dist[i] = (_accum_topic_sum[i] * 1.0/ _num_accum + _alpha) 
-                        / (size() + _alpha * _num_topics);
+                        / (length + _alpha * _num_topics);
     }
 }
 
 void LDADoc::accumulate_topic_sum() {
-    for (int i = 0; i < _num_topics; ++i) {
-        _accum_topic_sum[i] += _topic_sum[i];
+    if (_num_accum == 0) {
+        _sparse_accum = size() * SPARSE_DOC_TOPIC_RATIO < static_cast<size_t>(_num_topics);
+    }
+    if (_sparse_accum) {
+        for (const auto& token : _tokens) {
+            accumulate_topic(token.topic, 1);
+        }
+    } else {
+        for (int i = 0; i < _num_topics; ++i) {
+            _accum_topic_sum[i] += _topic_sum[i];
+        }
     }
     _num_accum += 1;
 }
+
+void LDADoc::merge_accum_topic_sum(const LDADoc& other) {
+    CHECK_EQ(_num_topics, other._num_topics) << "Topic number mismatch!";
+    CHECK_EQ(_sparse_accum, other._sparse_accum) << "Document length mismatch!";
+    for (size_t i = 0; i < other.num_accum_topics(); ++i) {
+        int t = other.accum_topic(i);
+        int count = other._accum_topic_sum[t];
+        if (count == 0) {
+            continue;
+        }
+        if (_sparse_accum) {
+            accumulate_topic(t, count);
+        } else {
+            _accum_topic_sum[t] += count;
+        }
+    }
+    _num_accum += other._num_accum;
+}
 // -------------LDA End---------------
 
 // --------Sentence-LDA Begin---------
 void SLDADoc::init(int num_topics) {
+    if (num_topics == _num_topics
+        && size() * SPARSE_DOC_TOPIC_RATIO < static_cast<size_t>(_num_topics)) {
+        // 上一篇文档为短文本, 只需清除其各个句子所在主题的计数
+        for (int topic : _sent_topics) {
+            _topic_sum[topic] = 0;
+        }
+    } else {
+        _topic_sum.assign(num_topics, 0);
+    }
     _num_topics = num_topics;
-    _sentences.clear();
-    _topic_sum.resize(_num_topics, 0);
-    _accum_topic_sum.resize(_num_topics, 0);
+    // 清空句子存储但保留容量, 复用文档时不再分配内存
+    _sent_topics.clear();
+    _sent_offsets.resize(1);
+    _word_ids.clear();
+    reset_accum_topic_sum(num_topics);
 }
 
-void SLDADoc::add_sentence(const Sentence& sent) {
-    CHECK_GE(sent.topic, 0) << "Topic " << sent.topic << " out of range!";
-    CHECK_LT(sent.topic, _num_topics) << "Topic " << sent.topic << " out of range!";
-    _sentences.push_back(sent);
-    _topic_sum[sent.topic]++;
+void SLDADoc::add_sentence(int topic, const int* ids, size_t size) {
+    CHECK_GE(topic, 0) << "Topic " << topic << " out of range!";
+    CHECK_LT(topic, _num_topics) << "Topic " << topic << " out of range!";
+    _sent_topics.push_back(topic);
+    _word_ids.insert(_word_ids.end(), ids, ids + size);
+    _sent_offsets.push_back(_word_ids.size());
+    _topic_sum[topic]++;
 }
 
 void SLDADoc::set_topic(int index, int new_topic) {
     CHECK_GE(new_topic, 0) << "Topic " << new_topic << " out of range!";
     CHECK_LT(new_topic, _num_topics) << "Topic " << new_topic << " out of range!";
-    int old_topic = _sentences[index].topic;
+    int old_topic = _sent_topics[index];
     if (new_topic == old_topic) {
         return;
     }
-    _sentences[index].topic = new_topic;
+    _sent_topics[index] = new_topic;
     _topic_sum[old_topic]--;
     _topic_sum[new_topic]++;
 }
+
+void SLDADoc::accumulate_topic_sum() {
+    if (_num_accum == 0) {
+        _sparse_accum = size() * SPARSE_DOC_TOPIC_RATIO < static_cast<size_t>(_num_topics);
+    }
+    if (_sparse_accum) {
+        for (int topic : _sent_topics) {
+            accumulate_topic(topic, 1);
+        }
+    } else {
+        for (int i = 0; i < _num_topics; ++i) {
+            _accum_topic_sum[i] += _topic_sum[i];
+        }
+    }
+    _num_accum += 1;
+}
 // --------Sentence-LDA End---------
 } // namespace familia
@@ -0,0 +1,49 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "familia/ftree.h"
+
+#include <algorithm>
+
+namespace familia {
+
+void FTree::init(int size) {
+    _size = size;
+    _capacity = 1;
+    while (_capacity < size) {
+        _capacity <<= 1;
+    }
+    _nodes.assign(2 * _capacity, 0.0);
+}
+
+void FTree::build() {
+    for (int i = _capacity - 1; i >= 1; --i) {
+        _nodes[i] = _nodes[2 * i] + _nodes[2 * i + 1];
+    }
+}
+
+void FTree::update(int index, double weight) {
+    int i = _capacity + index;
+    _nodes[i] = weight;
+    // 由子节点重新求和而非累加差值, 避免多次更新后的误差累积
+    for (i >>= 1; i >= 1; i >>= 1) {
+        _nodes[i] = _nodes[2 * i] + _nodes[2 * i + 1];
+    }
+}
+
+int FTree::sample(double dart) const {
+    int i = 1;
+    while (i < _capacity) {
+        int left = 2 * i;
+        // 浮点误差可能使dart落在权重为0的右子树, 此时改走左子树
+        if (dart < _nodes[left] || _nodes[left + 1] <= 0.0) {
+            i = left;
+        } else {
+            dart -= _nodes[left];
+            i = left + 1;
+        }
+    }
+    return std::min(i - _capacity, _size - 1);
+}
+} // namespace familia
@@ -0,0 +1,290 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "familia/gibbs_kernel.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FAMILIA_X86_KERNEL
+#include <immintrin.h>
+#endif
+
+namespace familia {
+
+// exp的多项式近似所用常数(Cephes expf), 先将x分解为n * ln2 + r, 再对exp(r)做多项式逼近
+static constexpr float EXP_LOWER_BOUND = -87.3f;
+static constexpr float EXP_LOG2E = 1.44269504088896341f;
+static constexpr float EXP_LN2_HI = 0.693359375f;
+static constexpr float EXP_LN2_LO = -2.12194440e-4f;
+static constexpr float EXP_P0 = 1.9875691500e-4f;
+static constexpr float EXP_P1 = 1.3981999507e-3f;
+static constexpr float EXP_P2 = 8.3334519073e-3f;
+static constexpr float EXP_P3 = 4.1665795894e-2f;
+static constexpr float EXP_P4 = 1.6666665459e-1f;
+static constexpr float EXP_P5 = 5.0000001201e-1f;
+
+static inline float exp_scalar(float x) {
+    x = x > EXP_LOWER_BOUND ? x : EXP_LOWER_BOUND;
+    int32_t n = static_cast<int32_t>(std::nearbyint(x * EXP_LOG2E));
+    float fn = static_cast<float>(n);
+    float r = x - fn * EXP_LN2_HI;
+    r = r - fn * EXP_LN2_LO;
+    float y = EXP_P0;
+    y = y * r + EXP_P1;
+    y = y * r + EXP_P2;
+    y = y * r + EXP_P3;
+    y = y * r + EXP_P4;
+    y = y * r + EXP_P5;
+    y = y * (r * r) + r;
+    y = y + 1.0f;
+    int32_t bits = (n + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return y * scale;
+}
+
+float gibbs_topic_prob(int32_t doc_count,
+                       int32_t word_count,
+                       float inv_denominator,
+                       float alpha,
+                       float beta) {
+    float dt_alpha = doc_count + alpha;
+    float wt_beta = word_count + beta;
+    return dt_alpha * wt_beta * inv_denominator;
+}
+
+// 标量实现, 同时用于处理向量实现剩余的尾部元素
+static void token_prob_scalar(const int32_t* doc_counts,
+                              const int32_t* word_counts,
+                              const float* inv_denominators,
+                              float alpha,
+                              float beta,
+                              int begin,
+                              int end,
+                              float* prob) {
+    for (int t = begin; t < end; ++t) {
+        prob[t] = gibbs_topic_prob(doc_counts[t], word_counts[t], inv_denominators[t], alpha, beta);
+    }
+}
+
+static void log_prob_scalar(const float* log_denominators,
+                            float num_words,
+                            float offset,
+                            int begin,
+                            int end,
+                            float* log_prob) {
+    for (int t = begin; t < end; ++t) {
+        log_prob[t] = offset - num_words * log_denominators[t];
+    }
+}
+
+static void exp_prob_scalar(float max_log_prob, int begin, int end, float* prob) {
+    for (int t = begin; t < end; ++t) {
+        prob[t] = exp_scalar(prob[t] - max_log_prob);
+    }
+}
+
+static void exp_prob_generic(float max_log_prob, int num_topics, float* prob) {
+    exp_prob_scalar(max_log_prob, 0, num_topics, prob);
+}
+
+static void token_prob_generic(const int32_t* doc_counts,
+                               const int32_t* word_counts,
+                               const float* inv_denominators,
+                               float alpha,
+                               float beta,
+                               int num_topics,
+                               float* prob) {
+    token_prob_scalar(doc_counts, word_counts, inv_denominators, alpha, beta, 0, num_topics, prob);
+}
+
+static void log_prob_generic(const float* log_denominators,
+                             float num_words,
+                             float offset,
+                             int num_topics,
+                             float* log_prob) {
+    log_prob_scalar(log_denominators, num_words, offset, 0, num_topics, log_prob);
+}
+
+#ifdef FAMILIA_X86_KERNEL
+static void token_prob_sse(const int32_t* doc_counts,
+                           const int32_t* word_counts,
+                           const float* inv_denominators,
+                           float alpha,
+                           float beta,
+                           int num_topics,
+                           float* prob) {
+    __m128 alpha_vec = _mm_set1_ps(alpha);
+    __m128 beta_vec = _mm_set1_ps(beta);
+    int t = 0;
+    for (; t + 4 <= num_topics; t += 4) {
+        __m128i dt = _mm_loadu_si128(reinterpret_cast<const __m128i*>(doc_counts + t));
+        __m128i wt = _mm_loadu_si128(reinterpret_cast<const __m128i*>(word_counts + t));
+        __m128 dt_alpha = _mm_add_ps(_mm_cvtepi32_ps(dt), alpha_vec);
+        __m128 wt_beta = _mm_add_ps(_mm_cvtepi32_ps(wt), beta_vec);
+        __m128 p = _mm_mul_ps(_mm_mul_ps(dt_alpha, wt_beta), _mm_loadu_ps(inv_denominators + t));
+        _mm_storeu_ps(prob + t, p);
+    }
+    token_prob_scalar(doc_counts, word_counts, inv_denominators, alpha, beta, t, num_topics, prob);
+}
+
+static void log_prob_sse(const float* log_denominators,
+                         float num_words,
+                         float offset,
+                         int num_topics,
+                         float* log_prob) {
+    __m128 words_vec = _mm_set1_ps(num_words);
+    __m128 offset_vec = _mm_set1_ps(offset);
+    int t = 0;
+    for (; t + 4 <= num_topics; t += 4) {
+        __m128 scaled = _mm_mul_ps(words_vec, _mm_loadu_ps(log_denominators + t));
+        _mm_storeu_ps(log_prob + t, _mm_sub_ps(offset_vec, scaled));
+    }
+    log_prob_scalar(log_denominators, num_words, offset, t, num_topics, log_prob);
+}
+
+static void exp_prob_sse(float max_log_prob, int num_topics, float* prob) {
+    __m128 max_vec = _mm_set1_ps(max_log_prob);
+    int t = 0;
+    for (; t + 4 <= num_topics; t += 4) {
+        __m128 x = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(prob + t), max_vec),
+                              _mm_set1_ps(EXP_LOWER_BOUND));
+        __m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(EXP_LOG2E)));
+        __m128 fn = _mm_cvtepi32_ps(n);
+        __m128 r = _mm_sub_ps(x, _mm_mul_ps(fn, _mm_set1_ps(EXP_LN2_HI)));
+        r = _mm_sub_ps(r, _mm_mul_ps(fn, _mm_set1_ps(EXP_LN2_LO)));
+        __m128 y = _mm_set1_ps(EXP_P0);
+        y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(EXP_P1));
+        y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(EXP_P2));
+        y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(EXP_P3));
+        y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(EXP_P4));
+        y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(EXP_P5));
+        y = _mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(r, r)), r);
+        y = _mm_add_ps(y, _mm_set1_ps(1.0f));
+        __m128i bits = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+        _mm_storeu_ps(prob + t, _mm_mul_ps(y, _mm_castsi128_ps(bits)));
+    }
+    exp_prob_scalar(max_log_prob, t, num_topics, prob);
+}
+
+__attribute__((target("avx2")))
+static void token_prob_avx2(const int32_t* doc_counts,
+                            const int32_t* word_counts,
+                            const float* inv_denominators,
+                            float alpha,
+                            float beta,
+                            int num_topics,
+                            float* prob) {
+    __m256 alpha_vec = _mm256_set1_ps(alpha);
+    __m256 beta_vec = _mm256_set1_ps(beta);
+    int t = 0;
+    for (; t + 8 <= num_topics; t += 8) {
+        __m256i dt = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(doc_counts + t));
+        __m256i wt = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(word_counts + t));
+        __m256 dt_alpha = _mm256_add_ps(_mm256_cvtepi32_ps(dt), alpha_vec);
+        __m256 wt_beta = _mm256_add_ps(_mm256_cvtepi32_ps(wt), beta_vec);
+        __m256 p = _mm256_mul_ps(_mm256_mul_ps(dt_alpha, wt_beta),
+                                 _mm256_loadu_ps(inv_denominators + t));
+        _mm256_storeu_ps(prob + t, p);
+    }
+    token_prob_scalar(doc_counts, word_counts, inv_denominators, alpha, beta, t, num_topics, prob);
+}
+
+__attribute__((target("avx2")))
+static void log_prob_avx2(const float* log_denominators,
+                          float num_words,
+                          float offset,
+                          int num_topics,
+                          float* log_prob) {
+    __m256 words_vec = _mm256_set1_ps(num_words);
+    __m256 offset_vec = _mm256_set1_ps(offset);
+    int t = 0;
+    for (; t + 8 <= num_topics; t += 8) {
+        __m256 scaled = _mm256_mul_ps(words_vec, _mm256_loadu_ps(log_denominators + t));
+        _mm256_storeu_ps(log_prob + t, _mm256_sub_ps(offset_vec, scaled));
+    }
+    log_prob_scalar(log_denominators, num_words, offset, t, num_topics, log_prob);
+}
+
+__attribute__((target("avx2")))
+static void exp_prob_avx2(float max_log_prob, int num_topics, float* prob) {
+    __m256 max_vec = _mm256_set1_ps(max_log_prob);
+    int t = 0;
+    for (; t + 8 <= num_topics; t += 8) {
+        __m256 x = _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(prob + t), max_vec),
+                                 _mm256_set1_ps(EXP_LOWER_BOUND));
+        __m256i n = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(EXP_LOG2E)));
+        __m256 fn = _mm256_cvtepi32_ps(n);
+        __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(fn, _mm256_set1_ps(EXP_LN2_HI)));
+        r = _mm256_sub_ps(r, _mm256_mul_ps(fn, _mm256_set1_ps(EXP_LN2_LO)));
+        __m256 y = _mm256_set1_ps(EXP_P0);
+        y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(EXP_P1));
+        y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(EXP_P2));
+        y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(EXP_P3));
+        y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(EXP_P4));
+        y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(EXP_P5));
+        y = _mm256_add_ps(_mm256_mul_ps(y, _mm256_mul_ps(r, r)), r);
+        y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+        __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23);
+        _mm256_storeu_ps(prob + t, _mm256_mul_ps(y, _mm256_castsi256_ps(bits)));
+    }
+    exp_prob_scalar(max_log_prob, t, num_topics, prob);
+}
+#endif
+
+static std::vector<GibbsKernel> detect_gibbs_kernels() {
+    std::vector<GibbsKernel> kernels;
+#ifdef FAMILIA_X86_KERNEL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({"avx2", token_prob_avx2, log_prob_avx2, exp_prob_avx2});
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        kernels.push_back({"sse", token_prob_sse, log_prob_sse, exp_prob_sse});
+    }
+#endif
+    kernels.push_back({"scalar", token_prob_generic, log_prob_generic, exp_prob_generic});
+    return kernels;
+}
+
+const std::vector<GibbsKernel>& supported_gibbs_kernels() {
+    static const std::vector<GibbsKernel> kernels = detect_gibbs_kernels();
+    return kernels;
+}
+
+// 运行时选择的内核实现
+static const GibbsKernel& gibbs_kernel() {
+    static const GibbsKernel& kernel = supported_gibbs_kernels().front();
+    return kernel;
+}
+
+void gibbs_token_prob(const int32_t* doc_counts,
+                      const int32_t* word_counts,
+                      const float* inv_denominators,
+                      float alpha,
+                      float beta,
+                      int num_topics,
+                      float* prob) {
+    gibbs_kernel().token_prob(doc_counts, word_counts, inv_denominators,
+                              alpha, beta, num_topics, prob);
+}
+
+void gibbs_log_prob(const float* log_denominators,
+                    float num_words,
+                    float offset,
+                    int num_topics,
+                    float* log_prob) {
+    gibbs_kernel().log_prob(log_denominators, num_words, offset, num_topics, log_prob);
+}
+
+void gibbs_exp_prob(float max_log_prob, int num_topics, float* prob) {
+    gibbs_kernel().exp_prob(max_log_prob, num_topics, prob);
+}
+
+const char* gibbs_kernel_name() {
+    return gibbs_kernel().name;
+}
+} // namespace familia
@@ -5,12 +5,42 @@
 #include "familia/inference_engine.h"
 
 #include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <stdlib.h>
 #include <memory>
 
 namespace familia {
 
+// 根据步数选择对应的MHSampler实例化版本
+template <typename TopicId>
+static std::unique_ptr<Sampler> new_mh_sampler(std::shared_ptr<TopicModel> model,
+                                               const std::string& alias_table_path,
+                                               bool lazy,
+                                               int mh_steps,
+                                               int prefetch_distance) {
+    LOG(INFO) << "MetropolisHastings steps = " << mh_steps
+              << ", topic id bytes = " << sizeof(TopicId)
+              << ", prefetch distance = " << prefetch_distance;
+    switch (mh_steps) {
+    case 1:
+        return std::unique_ptr<Sampler>(
+            new MHSampler<1, TopicId>(model, alias_table_path, lazy, prefetch_distance));
+    case 2:
+        return std::unique_ptr<Sampler>(
+            new MHSampler<2, TopicId>(model, alias_table_path, lazy, prefetch_distance));
+    case 3:
+        return std::unique_ptr<Sampler>(
+            new MHSampler<3, TopicId>(model, alias_table_path, lazy, prefetch_distance));
+    case 4:
+        return std::unique_ptr<Sampler>(
+            new MHSampler<4, TopicId>(model, alias_table_path, lazy, prefetch_distance));
+    default:
+        LOG(FATAL) << "Unsupported mh_steps " << mh_steps << ", must be in [1, 4]!";
+    }
+    return nullptr;
+}
+
 InferenceEngine::InferenceEngine(const std::string& model_dir,
                                  const std::string& conf_file,
                                  SamplerType type) {
@@ -19,85 +49,469 @@ InferenceEngine::InferenceEngine(const std::string& model_dir,
     ModelConfig config;
     load_prototxt(model_dir + "/" + conf_file, config);
     _model = std::make_shared<TopicModel>(model_dir, config);
+    _infer_threads = config.infer_threads();
+    _seed_salt = config.seed_salt();
+    _burn_in_iter = config.burn_in_iter();
+    _max_iter = config.max_iter();
+    _convergence_tolerance = config.convergence_tolerance();
+    _check_interval = config.check_interval();
+    _convergence_distance = config.convergence_distance();
+    _collapse_words = config.collapse_repeated_words();
+    _interleave_docs = config.batch_interleave_docs();
+    CHECK_GE(_burn_in_iter, 0) << "burn_in_iter must be non-negative!";
+    CHECK_GT(_max_iter, _burn_in_iter) << "max_iter must be greater than burn_in_iter!";
+    CHECK_GT(_check_interval, 0) << "check_interval must be positive!";
+    CHECK_GT(_interleave_docs, 0) << "batch_interleave_docs must be positive!";
 
     // 根据配置初始化采样器
     if (type == SamplerType::GibbsSampling) {
         LOG(INFO) << "Use GibbsSamling.";
         _sampler = std::unique_ptr<Sampler>(new GibbsSampler(_model));
+    } else if (type == SamplerType::SparseGibbsSampling) {
+        LOG(INFO) << "Use SparseGibbsSampling.";
+        _sampler = std::unique_ptr<Sampler>(new SparseGibbsSampler(_model));
+    } else if (type == SamplerType::FTreeSampling) {
+        LOG(INFO) << "Use FTreeSampling.";
+        _sampler = std::unique_ptr<Sampler>(new FTreeSampler(_model));
     } else if (type == SamplerType::MetropolisHastings) {
         LOG(INFO) << "Use MetropolisHastings.";
-        _sampler = std::unique_ptr<Sampler>(new MHSampler(_model));
+        std::string alias_table_file = config.alias_table_file().empty()
+                                       ? config.word_topic_file() + ".alias"
+                                       : config.alias_table_file();
+        std::string alias_table_path = model_dir + "/" + alias_table_file;
+        // 主题id可以用uint16_t表示时使用更紧凑的alias table表项
+        if (_model->num_topics() <= MAX_NARROW_TOPICS) {
+            _sampler = new_mh_sampler<uint16_t>(_model, alias_table_path,
+                                                config.lazy_alias_table(), config.mh_steps(),
+                                                config.mh_prefetch_distance());
+        } else {
+            _sampler = new_mh_sampler<int32_t>(_model, alias_table_path,
+                                               config.lazy_alias_table(), config.mh_steps(),
+                                               config.mh_prefetch_distance());
+        }
+    }
+
+    _cache_salt = 0;
+    if (config.result_cache_bytes() > 0) {
+        // 推断结果由词id序列和以下配置共同决定
+        const uint64_t settings[] = {static_cast<uint64_t>(type),
+                                     static_cast<uint64_t>(config.mh_steps()),
+                                     _seed_salt,
+                                     static_cast<uint64_t>(_burn_in_iter),
+                                     static_cast<uint64_t>(_max_iter),
+                                     static_cast<uint64_t>(_check_interval),
+                                     static_cast<uint64_t>(_convergence_distance),
+                                     static_cast<uint64_t>(_collapse_words)};
+        _cache_salt = hash_bytes(&_convergence_tolerance, sizeof(_convergence_tolerance),
+                                 hash_bytes(settings, sizeof(settings)));
+        _result_cache.reset(new ResultCache(config.result_cache_bytes(),
+                                            config.result_cache_shards()));
+        LOG(INFO) << "Result cache enabled, capacity = " << config.result_cache_bytes()
+                  << " bytes, #shards = " << config.result_cache_shards();
     }
 
+    LOG(INFO) << "Random number kernel: " << random_kernel_name();
     LOG(INFO) << "InferenceEngine initialize successfully!";
 }
 
-int InferenceEngine::infer(const std::vector<std::string>& input, LDADoc& doc) {
-    fix_random_seed(); // 固定随机数种子, 保证同样输入下推断的的主题分布稳定
+InferenceEngine::~InferenceEngine() {
+    if (_result_cache) {
+        LOG(INFO) << "Result cache #hits = " << _result_cache->hits()
+                  << " #misses = " << _result_cache->misses()
+                  << " #collisions = " << _result_cache->collisions()
+                  << " #entries = " << _result_cache->num_entries();
+    }
+}
+
+// 返回当前线程的推断上下文
+static InferenceContext& thread_local_context() {
+    thread_local InferenceContext context;
+    return context;
+}
+
+// 返回当前线程交错推断使用的推断上下文, 至少包含num_contexts个
+// 组内每篇文档只需独立的随机数序列及收敛检查点, 因此每次只批量生成少量随机数
+static std::vector<std::unique_ptr<InferenceContext>>& thread_local_contexts(size_t num_contexts) {
+    thread_local std::vector<std::unique_ptr<InferenceContext>> contexts;
+    while (contexts.size() < num_contexts) {
+        contexts.emplace_back(new InferenceContext(2 * Xoshiro256Plus::LANES));
+    }
+    return contexts;
+}
+
+int InferenceEngine::infer(const std::vector<std::string>& input, LDADoc& doc) const {
+    return infer(input, doc, thread_local_context());
+}
+
+int InferenceEngine::infer(const std::vector<std::string>& input,
+                           LDADoc& doc,
+                           InferenceContext& context) const {
+    init_doc(input, doc, context);
+    lda_infer(doc, _burn_in_iter, _max_iter, context);
+
+    return 0;
+}
+
+void InferenceEngine::init_doc(const std::vector<std::string>& input,
+                               LDADoc& doc,
+                               InferenceContext& context,
+                               int chain) const {
+    std::vector<int>& ids = context.id_buffer();
+    term_ids(input, ids);
+    // 随机数种子由词id序列和salt决定, 保证同样输入下推断的主题分布稳定
+    // 且与推断在哪个线程、以何种顺序进行无关
+    uint64_t seed = hash_bytes(ids.data(), sizeof(int) * ids.size(), _seed_salt);
+    if (chain != 0) {
+        seed = hash_bytes(&chain, sizeof(chain), seed);
+    }
+    context.seed(seed);
+    doc.init(_model->num_topics());
+    doc.set_alpha(_model->alpha());
+    for (int id : ids) {
+        int init_topic = context.rand_k(_model->num_topics());
+        doc.add_token({init_topic, id});
+    }
+}
+
+int InferenceEngine::infer_multi_chain(const std::vector<std::string>& input,
+                                       LDADoc& doc,
+                                       int num_chains) const {
+    if (num_chains <= 1) {
+        return infer(input, doc);
+    }
+    // 第0条链使用doc, 其余链使用从文档池借出的文档
+    std::vector<DocumentPool<LDADoc>::PooledDoc> chain_docs;
+    for (int c = 1; c < num_chains; ++c) {
+        chain_docs.push_back(_lda_doc_pool.acquire());
+    }
+    int num_accum = (_max_iter - _burn_in_iter + num_chains - 1) / num_chains;
+    thread_pool().parallel_for(num_chains, [&](size_t c, int) {
+        LDADoc& chain_doc = c == 0 ? doc : *chain_docs[c - 1];
+        InferenceContext& context = thread_local_context();
+        init_doc(input, chain_doc, context, static_cast<int>(c));
+        lda_infer(chain_doc, _burn_in_iter, _burn_in_iter + num_accum, context);
+    });
+
+    int num_sweeps = doc.num_sweeps();
+    for (const auto& chain_doc : chain_docs) {
+        doc.merge_accum_topic_sum(*chain_doc);
+        num_sweeps = std::max(num_sweeps, chain_doc->num_sweeps());
+    }
+    doc.set_num_sweeps(num_sweeps);
+
+    return 0;
+}
+
+int InferenceEngine::infer(const std::vector<std::vector<std::string>>& input,
+                           SLDADoc& doc) const {
+    return infer(input, doc, thread_local_context());
+}
+
+int InferenceEngine::infer(const std::vector<std::vector<std::string>>& input,
+                           SLDADoc& doc,
+                           InferenceContext& context) const {
     doc.init(_model->num_topics());
     doc.set_alpha(_model->alpha());
+    std::vector<int>& ids = context.id_buffer();
+    uint64_t seed = _seed_salt;
+    for (const auto& sent : input) {
+        term_ids(sent, ids);
+        // 逐句计算哈希, 句子长度参与哈希, 因此句子划分不同的输入得到不同的种子
+        seed = hash_bytes(ids.data(), sizeof(int) * ids.size(), seed);
+        // 种子依赖全部句子, 先以主题0加入文档, 确定种子后再随机初始化
+        doc.add_sentence(0, ids.data(), ids.size());
+    }
+    context.seed(seed);
+    for (size_t i = 0; i < doc.size(); ++i) {
+        doc.set_topic(i, context.rand_k(_model->num_topics()));
+    }
+
+    slda_infer(doc, _burn_in_iter, _max_iter, context);
+
+    return 0;
+}
+
+void InferenceEngine::term_ids(const std::vector<std::string>& input,
+                               std::vector<int>& ids) const {
+    ids.clear();
     for (const auto& token : input) {
         int id = _model->term_id(token);
         if (id != OOV) {
-            int init_topic = rand_k(_model->num_topics());
-            doc.add_token({init_topic, id});
+            ids.push_back(id);
         }
     }
+}
 
-    lda_infer(doc, 20, 50);
+int InferenceEngine::infer_topic_dist(const std::vector<std::string>& input,
+                                      DocTopicDist& result) const {
+    InferenceContext& context = thread_local_context();
+    std::vector<int>& ids = context.key_buffer();
+    uint64_t key = 0;
+    if (_result_cache) {
+        term_ids(input, ids);
+        key = hash_bytes(ids.data(), sizeof(int) * ids.size(), _cache_salt);
+        if (_result_cache->lookup(key, ids, result)) {
+            return 0;
+        }
+    }
+    auto doc = _lda_doc_pool.acquire();
+    infer(input, *doc, context);
+    doc->sparse_topic_dist(result.sparse);
+    doc->dense_topic_dist(result.dense);
+    if (_result_cache) {
+        _result_cache->insert(key, ids, result);
+    }
+    return 0;
+}
 
+int InferenceEngine::infer_topic_dist(const std::vector<std::vector<std::string>>& input,
+                                      DocTopicDist& result) const {
+    InferenceContext& context = thread_local_context();
+    std::vector<int>& ids = context.key_buffer();
+    uint64_t key = 0;
+    if (_result_cache) {
+        // 各句的词id依次拼接, 每句之后追加-1作为分隔, 句子划分不同的输入得到不同的序列
+        std::vector<int>& sent_ids = context.id_buffer();
+        ids.clear();
+        for (const auto& sent : input) {
+            term_ids(sent, sent_ids);
+            ids.insert(ids.end(), sent_ids.begin(), sent_ids.end());
+            ids.push_back(-1);
+        }
+        key = hash_bytes(ids.data(), sizeof(int) * ids.size(), _cache_salt);
+        if (_result_cache->lookup(key, ids, result)) {
+            return 0;
+        }
+    }
+    auto doc = _slda_doc_pool.acquire();
+    infer(input, *doc, context);
+    doc->sparse_topic_dist(result.sparse);
+    doc->dense_topic_dist(result.dense);
+    if (_result_cache) {
+        _result_cache->insert(key, ids, result);
+    }
     return 0;
 }
 
-int InferenceEngine::infer(const std::vector<std::vector<std::string>>& input, SLDADoc& doc) {
-    fix_random_seed(); // 固定随机数种子, 保证同样输入下推断的的主题分布稳定
-    doc.init(_model->num_topics());
-    doc.set_alpha(_model->alpha());
-    std::vector<int> words;
-    int init_topic;
-    for (const auto& sent : input) {
-        for (const auto& token : sent) {
-            int id = _model->term_id(token);
-            if (id != OOV) {
-                words.push_back(id);
+ThreadPool& InferenceEngine::thread_pool() const {
+    std::call_once(_thread_pool_flag, [this] {
+        _thread_pool.reset(new ThreadPool(_infer_threads));
+        LOG(INFO) << "Batch inference thread pool started! #threads = "
+                  << _thread_pool->num_threads();
+    });
+    return *_thread_pool;
+}
+
+int InferenceEngine::infer_batch(const std::vector<std::vector<std::string>>& inputs,
+                                 std::vector<LDADoc>& docs) const {
+    docs.resize(inputs.size());
+    if (_interleave_docs > 1 && !_collapse_words) {
+        // 短文本每_interleave_docs篇一组交错推断, 其余文档逐篇推断
+        // 输入的词数不小于去除词表外的词之后的词数, 因此按输入判断的短文本一定是短文本
+        std::vector<size_t> short_docs;
+        std::vector<size_t> long_docs;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (inputs[i].size() * SPARSE_DOC_TOPIC_RATIO
+                < static_cast<size_t>(_model->num_topics())) {
+                short_docs.push_back(i);
+            } else {
+                long_docs.push_back(i);
+            }
+        }
+        size_t group_size = _interleave_docs;
+        size_t num_groups = (short_docs.size() + group_size - 1) / group_size;
+        thread_pool().parallel_for(num_groups + long_docs.size(), [&](size_t task, int) {
+            if (task < num_groups) {
+                size_t begin = task * group_size;
+                infer_interleaved(inputs, docs, short_docs.data() + begin,
+                                  std::min(group_size, short_docs.size() - begin));
+            } else {
+                size_t i = long_docs[task - num_groups];
+                infer(inputs[i], docs[i]);
+            }
+        });
+        return 0;
+    }
+    // 每篇文档的随机数种子由其内容决定, 因此结果与文档被分配到哪个线程无关
+    thread_pool().parallel_for(inputs.size(), [&](size_t i, int) {
+        infer(inputs[i], docs[i]);
+    });
+
+    return 0;
+}
+
+void InferenceEngine::infer_interleaved(const std::vector<std::vector<std::string>>& inputs,
+                                        std::vector<LDADoc>& docs,
+                                        const size_t* indices,
+                                        size_t num_docs) const {
+    // 每篇文档使用独立的上下文, 其随机数序列与单独推断时相同
+    std::vector<std::unique_ptr<InferenceContext>>& contexts = thread_local_contexts(num_docs);
+    std::vector<LDADoc*> active_docs;
+    std::vector<InferenceContext*> active_contexts;
+    for (size_t k = 0; k < num_docs; ++k) {
+        LDADoc& doc = docs[indices[k]];
+        init_doc(inputs[indices[k]], doc, *contexts[k]);
+        active_docs.push_back(&doc);
+        active_contexts.push_back(contexts[k].get());
+    }
+
+    int num_sweeps = 0;
+    while (!active_docs.empty()) {
+        _sampler->sample_docs(active_docs.data(), active_contexts.data(), active_docs.size());
+        ++num_sweeps;
+        size_t num_active = 0;
+        for (size_t k = 0; k < active_docs.size(); ++k) {
+            LDADoc& doc = *active_docs[k];
+            if (end_sweep(doc, num_sweeps, _burn_in_iter, *active_contexts[k])
+                || num_sweeps == _max_iter) {
+                doc.set_num_sweeps(num_sweeps);
+            } else {
+                active_docs[num_active] = active_docs[k];
+                active_contexts[num_active] = active_contexts[k];
+                ++num_active;
             }
         }
-        // 随机初始化
-        init_topic = rand_k(_model->num_topics());
-        doc.add_sentence({init_topic, words});
-        words.clear();
+        active_docs.resize(num_active);
+        active_contexts.resize(num_active);
     }
+}
 
-    slda_infer(doc, 20, 50);
+int InferenceEngine::infer_batch(const std::vector<std::vector<std::vector<std::string>>>& inputs,
+                                 std::vector<SLDADoc>& docs) const {
+    docs.resize(inputs.size());
+    thread_pool().parallel_for(inputs.size(), [&](size_t i, int) {
+        infer(inputs[i], docs[i]);
+    });
 
     return 0;
 }
 
 void InferenceEngine::lda_infer(LDADoc& doc, int burn_in_iter, int total_iter) const {
+    lda_infer(doc, burn_in_iter, total_iter, thread_local_context());
+}
+
+void InferenceEngine::lda_infer(LDADoc& doc,
+                                int burn_in_iter,
+                                int total_iter,
+                                InferenceContext& context) const {
     CHECK_GE(burn_in_iter, 0);
     CHECK_GT(total_iter, 0);
     CHECK_GT(total_iter, burn_in_iter);
 
-    for (int iter = 0; iter < total_iter; ++iter) {
-        _sampler->sample_doc(doc);
-        if (iter >= burn_in_iter) { 
-            // 经过burn-in阶段后, 对每轮采样的结果进行累积，以得到更平滑的分布
-            doc.accumulate_topic_sum();
+    std::vector<int>& order = context.order_buffer();
+    if (_collapse_words) {
+        // 按词id排序, 词id相同时保持文档中的顺序, 整个推断过程中使用相同的采样顺序
+        order.resize(doc.size());
+        for (size_t i = 0; i < doc.size(); ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&doc](int a, int b) {
+            int id_a = doc.token(a).id;
+            int id_b = doc.token(b).id;
+            return id_a < id_b || (id_a == id_b && a < b);
+        });
+    }
+
+    int num_sweeps = 0;
+    while (num_sweeps < total_iter) {
+        if (_collapse_words) {
+            _sampler->sample_doc_by_word(doc, order, context);
+        } else {
+            _sampler->sample_doc(doc, context);
+        }
+        ++num_sweeps;
+        if (end_sweep(doc, num_sweeps, burn_in_iter, context)) {
+            break;
         }
     }
+    doc.set_num_sweeps(num_sweeps);
+}
+
+bool InferenceEngine::end_sweep(LDADoc& doc,
+                                int num_sweeps,
+                                int burn_in_iter,
+                                InferenceContext& context) const {
+    if (num_sweeps <= burn_in_iter) {
+        return false;
+    }
+    // 经过burn-in阶段后, 对每轮采样的结果进行累积，以得到更平滑的分布
+    doc.accumulate_topic_sum();
+    // 每累积check_interval轮检查一次是否收敛
+    int num_accum = num_sweeps - burn_in_iter;
+    return _convergence_tolerance > 0 && num_accum % _check_interval == 0 &&
+           converged(doc, num_accum / _check_interval - 1, context);
 }
 
 void InferenceEngine::slda_infer(SLDADoc& doc, int burn_in_iter, int total_iter) const {
+    slda_infer(doc, burn_in_iter, total_iter, thread_local_context());
+}
+
+void InferenceEngine::slda_infer(SLDADoc& doc,
+                                 int burn_in_iter,
+                                 int total_iter,
+                                 InferenceContext& context) const {
     CHECK_GE(burn_in_iter, 0);
     CHECK_GT(total_iter, 0);
     CHECK_GT(total_iter, burn_in_iter);
 
-    for (int iter = 0; iter < total_iter; ++iter) {
-        _sampler->sample_doc(doc);
-        if (iter >= burn_in_iter) {
+    int num_sweeps = 0;
+    while (num_sweeps < total_iter) {
+        _sampler->sample_doc(doc, context);
+        ++num_sweeps;
+        if (num_sweeps > burn_in_iter) {
             // 经过burn-in阶段后，对每轮采样的结果进行累积，以得到更平滑的分布
             doc.accumulate_topic_sum();
+            // 每累积check_interval轮检查一次是否收敛
+            int num_accum = num_sweeps - burn_in_iter;
+            if (_convergence_tolerance > 0 && num_accum % _check_interval == 0 &&
+                converged(doc, num_accum / _check_interval - 1, context)) {
+                break;
+            }
         }
     }
+    doc.set_num_sweeps(num_sweeps);
+}
+
+bool InferenceEngine::converged(const LDADoc& doc,
+                                int checkpoint,
+                                InferenceContext& context) const {
+    const std::vector<int>& accum_topic_sum = doc.accum_topic_sum();
+    // 只需遍历累积计数可能非零的主题, 短文本的开销与主题数无关
+    size_t num_accum_topics = doc.num_accum_topics();
+    int64_t sum = 0;
+    for (size_t i = 0; i < num_accum_topics; ++i) {
+        sum += accum_topic_sum[doc.accum_topic(i)];
+    }
+    if (sum == 0) {
+        return true; // 空文档无需继续采样
+    }
+
+    // 上一个检查点的分布按accum_topic的顺序存放, 其后新出现的主题在上一个检查点的概率为0
+    std::vector<float>& last_dist = context.topic_dist_buffer();
+    if (checkpoint == 0) {
+        last_dist.clear();
+    }
+    last_dist.resize(num_accum_topics, 0.0);
+    double distance = 0.0;
+    for (size_t i = 0; i < num_accum_topics; ++i) {
+        float prob = static_cast<float>(accum_topic_sum[doc.accum_topic(i)] * 1.0 / sum);
+        if (checkpoint > 0) {
+            if (_convergence_distance == ConvergenceDistance::HELLINGER_DISTANCE) {
+                double diff = std::sqrt(prob) - std::sqrt(last_dist[i]);
+                distance += diff * diff;
+            } else {
+                distance += std::fabs(prob - last_dist[i]);
+            }
+        }
+        last_dist[i] = prob;
+    }
+    if (checkpoint == 0) {
+        return false;
+    }
+    if (_convergence_distance == ConvergenceDistance::HELLINGER_DISTANCE) {
+        distance = std::sqrt(distance / 2.0);
+    }
+
+    return distance < _convergence_tolerance;
 }
 } // namespace familia
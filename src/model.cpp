@@ -4,7 +4,14 @@
 
 #include "familia/model.h"
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <thread>
 
 namespace familia {
 
@@ -15,9 +22,20 @@ TopicModel::TopicModel(const std::string& model_dir, const ModelConfig& config)
     _alpha_sum = _alpha * _num_topics;
     _topic_sum = std::vector<uint64_t>(_num_topics, 0);
     _type = config.type();
+    _validate_word_topic = config.validate_word_topic();
+    _load_threads = config.load_threads() > 0 ? config.load_threads()
+                                              : std::max(1u, std::thread::hardware_concurrency());
 
     // 加载模型
     load_model(model_dir + "/" + config.word_topic_file(), model_dir + "/" + config.vocab_file());
+
+    if (config.dense_row_threshold() > 0) {
+        build_dense_rows(config.dense_row_threshold(), config.dense_row_memory_mb());
+    }
+
+    if (config.phi_table_memory_mb() > 0) {
+        build_phi_rows(config.phi_table_memory_mb());
+    }
 }
 
 uint64_t TopicModel::topic_sum(int topic_id) const {
@@ -33,9 +51,29 @@ void TopicModel::load_model(const std::string& word_topic_path,
     _vocab.load(vocab_path);
 
     _beta_sum = _beta * _vocab.size();
-    _word_topic = std::vector<TopicDist>(_vocab.size());
-   
-    load_word_topic(word_topic_path);
+
+    // 根据文件头识别二进制格式, 否则按文本格式加载
+    char magic[sizeof(WORD_TOPIC_MAGIC)] = {0};
+    std::ifstream fin(word_topic_path.c_str(), std::ios::in | std::ios::binary);
+    CHECK(fin) << "Failed to open word topic file!";
+    fin.read(magic, sizeof(magic));
+    fin.close();
+    if (std::equal(magic, magic + sizeof(magic), WORD_TOPIC_MAGIC)) {
+        CHECK_EQ(load_binary_word_topic(word_topic_path), 0) << "Failed to load binary word topic!";
+    } else {
+        load_word_topic(word_topic_path);
+        _word_topic_checksum = compute_word_topic_checksum();
+    }
+    float hyper_params[] = {static_cast<float>(_num_topics), _alpha, _beta};
+    _checksum = hash_bytes(&_word_topic_checksum, sizeof(_word_topic_checksum),
+                           hash_bytes(hyper_params, sizeof(hyper_params)));
+
+    _log_topic_denominator.resize(_num_topics);
+    _inv_topic_denominator.resize(_num_topics);
+    for (int t = 0; t < _num_topics; ++t) {
+        _log_topic_denominator[t] = std::log(_topic_sum[t] + static_cast<double>(_beta_sum));
+        _inv_topic_denominator[t] = 1.0 / (_topic_sum[t] + static_cast<double>(_beta_sum));
+    }
 
     LOG(INFO) << "Model Info: #num_topics = " << num_topics() << " #vocab_size = " << vocab_size()
               << " alpha = " << alpha() << " beta = " << beta();
@@ -43,41 +81,389 @@ void TopicModel::load_model(const std::string& word_topic_path,
 
 void TopicModel::load_word_topic(const std::string& word_topic_path) {
     LOG(INFO) << "Loading word topic from " << word_topic_path;
-    std::ifstream fin(word_topic_path.c_str(), std::ios::in);
-    CHECK(fin) << "Failed to open word topic file!";
+    auto start_time = std::chrono::steady_clock::now();
+    MappedFile file;
+    CHECK_EQ(file.open(word_topic_path), 0) << "Failed to open word topic file!";
 
-    std::string line;
-    while (getline(fin, line)) {
-        std::vector<std::string> fields;
-        split(fields, line, ' ');
+    // 按字节将文件切分为若干分片, 分片边界对齐到行首
+    const char* data = file.data();
+    const char* data_end = data + file.size();
+    size_t num_chunks = std::max<size_t>(1, std::min<size_t>(_load_threads, file.size() >> 20));
+    std::vector<const char*> bounds(num_chunks + 1, data_end);
+    bounds[0] = data;
+    for (size_t i = 1; i < num_chunks; ++i) {
+        const char* pos = std::max(bounds[i - 1], data + file.size() / num_chunks * i);
+        while (pos < data_end && pos > data && pos[-1] != '\n') {
+            ++pos;
+        }
+        bounds[i] = pos;
+    }
 
-        CHECK_GT(fields.size(), 0) << "Model file format error!";
+    // 每个线程解析一个分片, 结果存放在线程各自的缓冲区中
+    std::vector<WordTopicChunk> chunks(num_chunks);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_chunks; ++i) {
+        threads.emplace_back(&TopicModel::parse_word_topic_chunk, this,
+                             bounds[i], bounds[i + 1], std::ref(chunks[i]));
+    }
+    parse_word_topic_chunk(bounds[0], bounds[1], chunks[0]);
+    for (auto& thread : threads) {
+        thread.join();
+    }
 
-        int term_id = std::stoi(fields[0]);
+    // 合并各分片的topic sum
+    for (const auto& chunk : chunks) {
+        for (int t = 0; t < _num_topics; ++t) {
+            _topic_sum[t] += chunk.topic_sum[t];
+        }
+    }
+    build_word_topic(chunks);
 
-        CHECK_LT(term_id, vocab_size()) << "Term id out of range!";
-        CHECK_GE(term_id, 0) << "Term id out of range!";
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                                   - start_time).count();
+    LOG(INFO) << "Word topic load successfully! #threads = " << num_chunks
+              << " throughput = " << file.size() / 1048576.0 / std::max(seconds, 1e-6) << "MB/s";
+}
 
-        for (size_t i = 1; i < fields.size(); ++i) {
-            std::vector<std::string> topic_count;
-            split(topic_count, fields[i], ':');
-            CHECK_EQ(topic_count.size(), 2) << "Topic count format error!";
+void TopicModel::parse_word_topic_chunk(const char* begin,
+                                        const char* end,
+                                        WordTopicChunk& chunk) const {
+    chunk.topic_sum.assign(_num_topics, 0);
+    const char* ptr = begin;
+    while (ptr < end) {
+        const char* line_end = static_cast<const char*>(memchr(ptr, '\n', end - ptr));
+        if (line_end == nullptr) {
+            line_end = end;
+        }
+        // 跳过行尾的空白字符以及空行
+        const char* content_end = line_end;
+        while (content_end > ptr && isspace(static_cast<unsigned char>(content_end[-1]))) {
+            --content_end;
+        }
+        if (content_end == ptr) {
+            ptr = line_end + 1;
+            continue;
+        }
 
-            int topic_id = std::stoi(topic_count[0]);
-            CHECK_GE(topic_id, 0) << "Topic out of range!";
-            CHECK_LT(topic_id, _num_topics) << "Topic out of range!";
+        int term_id = 0;
+        CHECK(parse_uint(ptr, content_end, term_id)) << "Model file format error!";
+        CHECK_LT(term_id, vocab_size()) << "Term id out of range!";
 
-            int count = std::stoi(topic_count[1]);
+        while (ptr < content_end) {
+            CHECK_EQ(*ptr, ' ') << "Model file format error!";
+            ++ptr;
+            int topic_id = 0;
+            int count = 0;
+            CHECK(parse_uint(ptr, content_end, topic_id)) << "Topic count format error!";
+            CHECK(ptr < content_end && *ptr == ':') << "Topic count format error!";
+            ++ptr;
+            CHECK(parse_uint(ptr, content_end, count)) << "Topic count format error!";
+            CHECK_LT(topic_id, _num_topics) << "Topic out of range!";
             CHECK_GT(count, 0) << "Topic count error!";
-            
-            _word_topic[term_id].emplace_back(topic_id, count);
-            _topic_sum[topic_id] += count;
+
+            chunk.term_ids.push_back(term_id);
+            chunk.topic_counts.emplace_back(topic_id, count);
+            chunk.topic_sum[topic_id] += count;
+        }
+        ptr = line_end + 1;
+    }
+}
+
+void TopicModel::build_word_topic(const std::vector<WordTopicChunk>& chunks) {
+    // 按词id做计数排序, 得到CSR格式的偏移量
+    _offsets_storage.assign(vocab_size() + 1, 0);
+    for (const auto& chunk : chunks) {
+        for (int32_t term_id : chunk.term_ids) {
+            _offsets_storage[term_id + 1]++;
+        }
+    }
+    for (size_t i = 0; i < vocab_size(); ++i) {
+        _offsets_storage[i + 1] += _offsets_storage[i];
+    }
+    size_t nnz = _offsets_storage.back();
+    std::vector<TopicCount> sorted(nnz);
+    std::vector<uint64_t> cursor(_offsets_storage.begin(), _offsets_storage.end() - 1);
+    for (const auto& chunk : chunks) {
+        for (size_t i = 0; i < chunk.term_ids.size(); ++i) {
+            sorted[cursor[chunk.term_ids[i]]++] = chunk.topic_counts[i];
         }
+    }
+    std::vector<uint64_t>().swap(cursor);
+
+    bool narrow = _num_topics <= MAX_NARROW_TOPICS;
+    if (narrow) {
+        _narrow_ids_storage.resize(nnz);
+    } else {
+        _wide_ids_storage.resize(nnz);
+    }
+    _counts_storage.resize(nnz);
+    for (size_t i = 0; i < vocab_size(); ++i) {
         // 按照主题下标进行排序
-        std::sort(_word_topic[term_id].begin(), _word_topic[term_id].end());
+        std::sort(sorted.begin() + _offsets_storage[i], sorted.begin() + _offsets_storage[i + 1]);
+    }
+    for (size_t i = 0; i < nnz; ++i) {
+        if (narrow) {
+            _narrow_ids_storage[i] = static_cast<uint16_t>(sorted[i].first);
+        } else {
+            _wide_ids_storage[i] = sorted[i].first;
+        }
+        _counts_storage[i] = sorted[i].second;
     }
 
-    fin.close();
-    LOG(INFO) << "Word topic load successfully!";
+    _offsets = _offsets_storage.data();
+    _narrow_ids = narrow ? _narrow_ids_storage.data() : nullptr;
+    _wide_ids = narrow ? nullptr : _wide_ids_storage.data();
+    _counts = _counts_storage.data();
+}
+
+// 二进制文件中topic_ids数组补齐至8字节对齐后的字节数
+static inline size_t aligned_topic_ids_bytes(uint64_t num_nonzeros, uint32_t topic_id_bytes) {
+    size_t bytes = num_nonzeros * topic_id_bytes;
+    return (bytes + 7) & ~static_cast<size_t>(7);
+}
+
+template <typename TopicId>
+bool TopicModel::validate_topic_counts(const TopicId* topic_ids) const {
+    for (size_t w = 0; w < vocab_size(); ++w) {
+        for (uint64_t i = _offsets[w]; i < _offsets[w + 1]; ++i) {
+            int topic_id = topic_ids[i];
+            // 每行的主题id需有序, 以保证find_topic的二分查找正确
+            if (topic_id < 0 || topic_id >= _num_topics
+                || (i > _offsets[w] && topic_id < static_cast<int>(topic_ids[i - 1]))) {
+                LOG(ERROR) << "Binary word topic of word " << w << " has invalid topic id "
+                           << topic_id;
+                return false;
+            }
+            if (_counts[i] <= 0) {
+                LOG(ERROR) << "Binary word topic of word " << w << " has invalid count "
+                           << _counts[i];
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool TopicModel::validate_word_topic() const {
+    bool valid = _narrow_ids != nullptr ? validate_topic_counts(_narrow_ids)
+                                        : validate_topic_counts(_wide_ids);
+    if (valid && compute_word_topic_checksum() != _word_topic_checksum) {
+        LOG(ERROR) << "Word topic checksum mismatch!";
+        return false;
+    }
+    return valid;
+}
+
+int TopicModel::load_binary_word_topic(const std::string& word_topic_path) {
+    LOG(INFO) << "Loading binary word topic from " << word_topic_path;
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    if (file->open(word_topic_path) != 0) {
+        return -1;
+    }
+    if (file->size() < sizeof(WordTopicHeader)) {
+        LOG(ERROR) << "Binary word topic file is truncated!";
+        return -1;
+    }
+    const WordTopicHeader* header = reinterpret_cast<const WordTopicHeader*>(file->data());
+    if (header->version != WORD_TOPIC_VERSION) {
+        LOG(ERROR) << "Unsupported binary word topic version " << header->version
+                   << ", expected " << WORD_TOPIC_VERSION;
+        return -1;
+    }
+    if (static_cast<int>(header->num_topics) != _num_topics
+        || header->vocab_size != vocab_size()) {
+        LOG(ERROR) << "Binary word topic mismatch with config or vocabulary: #num_topics = "
+                   << header->num_topics << " #vocab_size = " << header->vocab_size;
+        return -1;
+    }
+    uint32_t expected_id_bytes = _num_topics <= MAX_NARROW_TOPICS ? sizeof(uint16_t)
+                                                                   : sizeof(int32_t);
+    if (header->topic_id_bytes != expected_id_bytes) {
+        LOG(ERROR) << "Binary word topic id width " << header->topic_id_bytes
+                   << " mismatch, expected " << expected_id_bytes;
+        return -1;
+    }
+    // 先用文件大小约束文件头中的计数, 避免计算期望大小时溢出
+    uint64_t max_elements = file->size() / sizeof(int32_t);
+    if (header->num_nonzeros > max_elements || header->vocab_size >= max_elements) {
+        LOG(ERROR) << "Binary word topic file size " << file->size()
+                   << " too small for #num_nonzeros = " << header->num_nonzeros;
+        return -1;
+    }
+    size_t ids_bytes = aligned_topic_ids_bytes(header->num_nonzeros, header->topic_id_bytes);
+    size_t expected_size = sizeof(WordTopicHeader)
+                           + sizeof(uint64_t) * header->num_topics
+                           + sizeof(uint64_t) * (header->vocab_size + 1)
+                           + ids_bytes
+                           + sizeof(int32_t) * header->num_nonzeros;
+    if (file->size() != expected_size) {
+        LOG(ERROR) << "Binary word topic file size " << file->size()
+                   << " mismatch, expected " << expected_size;
+        return -1;
+    }
+
+    const char* ptr = file->data() + sizeof(WordTopicHeader);
+    const uint64_t* topic_sum = reinterpret_cast<const uint64_t*>(ptr);
+    _topic_sum.assign(topic_sum, topic_sum + header->num_topics);
+    ptr += sizeof(uint64_t) * header->num_topics;
+    _offsets = reinterpret_cast<const uint64_t*>(ptr);
+    ptr += sizeof(uint64_t) * (header->vocab_size + 1);
+    if (header->topic_id_bytes == sizeof(uint16_t)) {
+        _narrow_ids = reinterpret_cast<const uint16_t*>(ptr);
+        _wide_ids = nullptr;
+    } else {
+        _narrow_ids = nullptr;
+        _wide_ids = reinterpret_cast<const int32_t*>(ptr);
+    }
+    ptr += ids_bytes;
+    _counts = reinterpret_cast<const int32_t*>(ptr);
+    _word_topic_checksum = header->checksum;
+    // 加载时只校验O(vocab_size)的偏移量, 保证每行的访问不越界, 不读取主题id及计数所在的页
+    if (_offsets[0] != 0 || _offsets[header->vocab_size] != header->num_nonzeros) {
+        LOG(ERROR) << "Binary word topic offsets corrupted!";
+        return -1;
+    }
+    for (uint64_t w = 0; w < header->vocab_size; ++w) {
+        if (_offsets[w] > _offsets[w + 1]) {
+            LOG(ERROR) << "Binary word topic offsets of word " << w << " are not monotonic!";
+            return -1;
+        }
+    }
+    // 逐项校验需要读取整个文件, 仅在配置开启时进行
+    if (_validate_word_topic && !validate_word_topic()) {
+        return -1;
+    }
+    _mapped_file = std::move(file);
+
+    LOG(INFO) << "Binary word topic load successfully! #num_nonzeros = " << header->num_nonzeros;
+    return 0;
+}
+
+int TopicModel::save_binary_word_topic(const std::string& word_topic_path) const {
+    std::ofstream fout(word_topic_path.c_str(), std::ios::out | std::ios::binary);
+    if (!fout) {
+        LOG(ERROR) << "Failed to open output file: " << word_topic_path;
+        return -1;
+    }
+    WordTopicHeader header;
+    std::copy(WORD_TOPIC_MAGIC, WORD_TOPIC_MAGIC + sizeof(WORD_TOPIC_MAGIC), header.magic);
+    header.version = WORD_TOPIC_VERSION;
+    header.num_topics = _num_topics;
+    header.vocab_size = vocab_size();
+    header.num_nonzeros = _offsets[vocab_size()];
+    header.topic_id_bytes = _narrow_ids != nullptr ? sizeof(uint16_t) : sizeof(int32_t);
+    header.reserved = 0;
+    header.checksum = _word_topic_checksum;
+
+    fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    fout.write(reinterpret_cast<const char*>(_topic_sum.data()),
+               sizeof(uint64_t) * _topic_sum.size());
+    fout.write(reinterpret_cast<const char*>(_offsets), sizeof(uint64_t) * (vocab_size() + 1));
+    size_t ids_bytes = header.num_nonzeros * header.topic_id_bytes;
+    if (_narrow_ids != nullptr) {
+        fout.write(reinterpret_cast<const char*>(_narrow_ids), ids_bytes);
+    } else {
+        fout.write(reinterpret_cast<const char*>(_wide_ids), ids_bytes);
+    }
+    std::vector<char> padding(aligned_topic_ids_bytes(header.num_nonzeros,
+                                                      header.topic_id_bytes) - ids_bytes, 0);
+    fout.write(padding.data(), padding.size());
+    fout.write(reinterpret_cast<const char*>(_counts), sizeof(int32_t) * header.num_nonzeros);
+    fout.close();
+    if (!fout) {
+        LOG(ERROR) << "Failed to write binary word topic: " << word_topic_path;
+        return -1;
+    }
+
+    LOG(INFO) << "Save binary word topic to " << word_topic_path << " successfully!";
+    return 0;
+}
+
+uint64_t TopicModel::compute_word_topic_checksum() const {
+    uint64_t h = hash_bytes(_topic_sum.data(), sizeof(uint64_t) * _topic_sum.size());
+    h = hash_bytes(_offsets, sizeof(uint64_t) * (vocab_size() + 1), h);
+    if (_narrow_ids != nullptr) {
+        h = hash_bytes(_narrow_ids, sizeof(uint16_t) * num_nonzeros(), h);
+    } else {
+        h = hash_bytes(_wide_ids, sizeof(int32_t) * num_nonzeros(), h);
+    }
+    h = hash_bytes(_counts, sizeof(int32_t) * num_nonzeros(), h);
+
+    return h;
+}
+
+void TopicModel::build_dense_rows(float threshold, int memory_mb) {
+    // 选出非零项比例达到阈值的词, 并按非零项数量从大到小排序
+    std::vector<std::pair<uint64_t, int>> candidates;
+    for (size_t i = 0; i < vocab_size(); ++i) {
+        uint64_t nnz = _offsets[i + 1] - _offsets[i];
+        if (nnz > 0 && nnz >= threshold * _num_topics) {
+            candidates.emplace_back(nnz, i);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), std::greater<std::pair<uint64_t, int>>());
+
+    size_t row_bytes = sizeof(int32_t) * _num_topics;
+    size_t max_rows = static_cast<size_t>(memory_mb) * 1024 * 1024 / row_bytes;
+    if (candidates.size() > max_rows) {
+        LOG(WARNING) << "Dense rows exceed memory budget, keep " << max_rows
+                     << " of " << candidates.size() << " candidate words";
+        candidates.resize(max_rows);
+    }
+
+    _dense_row_index.assign(vocab_size(), -1);
+    _dense_counts.assign(candidates.size() * _num_topics, 0);
+    for (size_t r = 0; r < candidates.size(); ++r) {
+        int word_id = candidates[r].second;
+        WordTopicRow row = word_topic(word_id);
+        int32_t* dense = _dense_counts.data() + r * _num_topics;
+        for (size_t j = 0; j < row.size; ++j) {
+            dense[row.topic(j)] = row.count(j);
+        }
+        _dense_row_index[word_id] = r;
+    }
+
+    LOG(INFO) << "Build dense rows for " << candidates.size() << " words, threshold = "
+              << threshold << " memory = " << candidates.size() * row_bytes / 1048576.0 << "MB";
+}
+
+void TopicModel::build_phi_rows(int memory_mb) {
+    // 按词在训练语料中的出现次数从大到小排序
+    std::vector<std::pair<uint64_t, int>> candidates;
+    for (size_t i = 0; i < vocab_size(); ++i) {
+        uint64_t word_count = 0;
+        for (uint64_t pos = _offsets[i]; pos < _offsets[i + 1]; ++pos) {
+            word_count += _counts[pos];
+        }
+        if (word_count > 0) {
+            candidates.emplace_back(word_count, i);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), std::greater<std::pair<uint64_t, int>>());
+
+    size_t row_bytes = sizeof(float) * _num_topics;
+    size_t max_rows = static_cast<size_t>(memory_mb) * 1024 * 1024 / row_bytes;
+    if (candidates.size() > max_rows) {
+        candidates.resize(max_rows);
+    }
+
+    // 计数为0的主题同样写入平滑后的概率, 查询时无需查找主题id
+    _phi_row_index.assign(vocab_size(), -1);
+    _phi.resize(candidates.size() * _num_topics);
+    for (size_t r = 0; r < candidates.size(); ++r) {
+        int word_id = candidates[r].second;
+        float* phi = _phi.data() + r * _num_topics;
+        for (int t = 0; t < _num_topics; ++t) {
+            phi[t] = _beta * _inv_topic_denominator[t];
+        }
+        WordTopicRow row = word_topic(word_id);
+        for (size_t j = 0; j < row.size; ++j) {
+            phi[row.topic(j)] = (row.count(j) + _beta) * _inv_topic_denominator[row.topic(j)];
+        }
+        _phi_row_index[word_id] = r;
+    }
+
+    LOG(INFO) << "Build phi rows for " << candidates.size() << " words, memory = "
+              << candidates.size() * row_bytes / 1048576.0 << "MB";
 }
 } // namespace familia
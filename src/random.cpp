@@ -0,0 +1,95 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "familia/random.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FAMILIA_X86_KERNEL
+#endif
+
+namespace familia {
+
+typedef uint64_t RandomState[4][Xoshiro256Plus::LANES];
+
+static inline uint64_t splitmix64(uint64_t& x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void Xoshiro256Plus::seed(uint64_t seed) {
+    for (int lane = 0; lane < LANES; ++lane) {
+        for (int i = 0; i < 4; ++i) {
+            _state[i][lane] = splitmix64(seed);
+        }
+    }
+}
+
+// 各路之间相互独立, 内层循环可被编译器向量化
+// 浮点数由随机数的高52位直接拼接为[1, 2)之间的double再减1得到, 避免整数到浮点数的转换
+static inline __attribute__((always_inline))
+void fill_uniform_impl(RandomState& s, double* out, size_t n) {
+    const int lanes = Xoshiro256Plus::LANES;
+    for (size_t i = 0; i < n; i += lanes) {
+        for (int lane = 0; lane < lanes; ++lane) {
+            uint64_t result = s[0][lane] + s[3][lane];
+            uint64_t t = s[1][lane] << 17;
+            s[2][lane] ^= s[0][lane];
+            s[3][lane] ^= s[1][lane];
+            s[1][lane] ^= s[2][lane];
+            s[0][lane] ^= s[3][lane];
+            s[2][lane] ^= t;
+            s[3][lane] = (s[3][lane] << 45) | (s[3][lane] >> 19);
+
+            uint64_t bits = (result >> 12) | 0x3ff0000000000000ULL;
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            out[i + lane] = value - 1.0;
+        }
+    }
+}
+
+static void fill_uniform_generic(RandomState& s, double* out, size_t n) {
+    fill_uniform_impl(s, out, n);
+}
+
+#ifdef FAMILIA_X86_KERNEL
+__attribute__((target("avx2")))
+static void fill_uniform_avx2(RandomState& s, double* out, size_t n) {
+    fill_uniform_impl(s, out, n);
+}
+#endif
+
+// 运行时选择的批量生成实现
+struct RandomKernel {
+    const char* name;
+    void (*fill_uniform)(RandomState&, double*, size_t);
+};
+
+static RandomKernel select_random_kernel() {
+#ifdef FAMILIA_X86_KERNEL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {"avx2", fill_uniform_avx2};
+    }
+#endif
+    return {"generic", fill_uniform_generic};
+}
+
+static const RandomKernel& random_kernel() {
+    static const RandomKernel kernel = select_random_kernel();
+    return kernel;
+}
+
+void Xoshiro256Plus::fill_uniform(double* out, size_t n) {
+    random_kernel().fill_uniform(_state, out, n);
+}
+
+const char* random_kernel_name() {
+    return random_kernel().name;
+}
+} // namespace familia
@@ -0,0 +1,122 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "familia/result_cache.h"
+
+#include <algorithm>
+
+namespace familia {
+
+ResultCache::ResultCache(size_t capacity_bytes, int num_shards) {
+    num_shards = std::max(num_shards, 1);
+    _shard_capacity = capacity_bytes / num_shards;
+    for (int i = 0; i < num_shards; ++i) {
+        _shards.emplace_back(new Shard());
+    }
+}
+
+size_t ResultCache::entry_bytes(const std::vector<int>& ids, const DocTopicDist& value) {
+    // 链表节点含两个指针, 哈希表节点含next指针、键值对及桶指针
+    const size_t overhead = sizeof(Entry) + 2 * sizeof(void*)
+                            + sizeof(uint64_t) + sizeof(std::list<Entry>::iterator)
+                            + 2 * sizeof(void*);
+    return overhead + ids.size() * sizeof(int) + value.sparse.size() * sizeof(Topic) + value.dense.size() * sizeof(float);
+}
+
+bool ResultCache::lookup(uint64_t key, const std::vector<int>& ids, DocTopicDist& result) {
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.index.find(key);
+    if (it == s.index.end()) {
+        s.misses++;
+        return false;
+    }
+    if (it->second->ids != ids) {
+        s.misses++;
+        s.collisions++;
+        return false;
+    }
+    s.hits++;
+    // 移动到链表头部
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    result.sparse = it->second->value.sparse;
+    result.dense = it->second->value.dense;
+    return true;
+}
+
+void ResultCache::insert(uint64_t key, const std::vector<int>& ids, const DocTopicDist& result) {
+    size_t bytes = entry_bytes(ids, result);
+    if (bytes > _shard_capacity) {
+        return;
+    }
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.index.find(key);
+    if (it != s.index.end()) {
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        if (it->second->ids == ids) {
+            // 其他线程已插入相同的输入, 结果相同, 只更新其使用时间
+            return;
+        }
+        // 哈希冲突, 以新结果替换旧结果
+        s.bytes -= it->second->bytes;
+        s.lru.pop_front();
+        s.index.erase(it);
+    }
+    s.lru.push_front({key, ids, result, bytes});
+    s.index[key] = s.lru.begin();
+    s.bytes += bytes;
+    while (s.bytes > _shard_capacity) {
+        const Entry& victim = s.lru.back();
+        s.bytes -= victim.bytes;
+        s.index.erase(victim.key);
+        s.lru.pop_back();
+    }
+}
+
+uint64_t ResultCache::hits() const {
+    uint64_t hits = 0;
+    for (const auto& s : _shards) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        hits += s->hits;
+    }
+    return hits;
+}
+
+uint64_t ResultCache::misses() const {
+    uint64_t misses = 0;
+    for (const auto& s : _shards) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        misses += s->misses;
+    }
+    return misses;
+}
+
+uint64_t ResultCache::collisions() const {
+    uint64_t collisions = 0;
+    for (const auto& s : _shards) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        collisions += s->collisions;
+    }
+    return collisions;
+}
+
+size_t ResultCache::num_entries() const {
+    size_t num_entries = 0;
+    for (const auto& s : _shards) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        num_entries += s->lru.size();
+    }
+    return num_entries;
+}
+
+size_t ResultCache::size_bytes() const {
+    size_t bytes = 0;
+    for (const auto& s : _shards) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        bytes += s->bytes;
+    }
+    return bytes;
+}
+} // namespace familia
@@ -3,79 +3,172 @@
 // found in the LICENSE file.
 
 #include "familia/sampler.h"
+#include "familia/gibbs_kernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
 
 namespace familia {
 
-void MHSampler::sample_doc(LDADoc& doc) {
+template <int MHSteps, typename TopicId>
+void MHSampler<MHSteps, TopicId>::sample_doc(LDADoc& doc, InferenceContext& context) const {
     for (size_t i = 0; i < doc.size(); ++i) {
-        int new_topic = sample_token(doc, doc.token(i));
+        if (_prefetch_distance > 0) {
+            prefetch_ahead(doc, nullptr, i, _prefetch_distance);
+        }
+        Token& token = doc.token(i);
+        int new_topic = sample_token(doc, token, word_alias(token.id), context);
         doc.set_topic(i, new_topic);
     }
-};
+}
+
+template <int MHSteps, typename TopicId>
+void MHSampler<MHSteps, TopicId>::sample_doc_by_word(LDADoc& doc,
+                                                     const std::vector<int>& order,
+                                                     InferenceContext& context) const {
+    size_t i = 0;
+    while (i < order.size()) {
+        int word_id = doc.token(order[i]).id;
+        size_t end = i + 1;
+        while (end < order.size() && doc.token(order[end]).id == word_id) {
+            ++end;
+        }
+        WordAlias alias = word_alias(word_id);
+        bool expanded = false;
+        if (end - i >= MIN_EXPAND_OCCURRENCES) {
+            alias.counts = _model->dense_row(word_id);
+            if (alias.counts == nullptr) {
+                std::vector<int32_t>& counts = context.count_buffer(_model->num_topics());
+                WordTopicRow row = _model->word_topic(word_id);
+                for (size_t j = 0; j < row.size; ++j) {
+                    counts[row.topic(j)] = row.count(j);
+                }
+                alias.counts = counts.data();
+                expanded = true;
+            }
+        }
+        for (; i < end; ++i) {
+            if (_prefetch_distance > 0) {
+                prefetch_ahead(doc, order.data(), i, _prefetch_distance);
+            }
+            Token& token = doc.token(order[i]);
+            int new_topic = sample_token(doc, token, alias, context);
+            doc.set_topic(order[i], new_topic);
+        }
+        if (expanded) {
+            std::vector<int32_t>& counts = context.count_buffer(_model->num_topics());
+            WordTopicRow row = _model->word_topic(word_id);
+            for (size_t j = 0; j < row.size; ++j) {
+                counts[row.topic(j)] = 0;
+            }
+        }
+    }
+}
+
+template <int MHSteps, typename TopicId>
+void MHSampler<MHSteps, TopicId>::sample_docs(LDADoc* const* docs,
+                                              InferenceContext* const* contexts,
+                                              size_t num_docs) const {
+    // 采样一篇文档的词与预取该文档之后的词之间隔着组内其他文档的采样, 因此距离为1即可
+    size_t distance = std::max(_prefetch_distance, 1);
+    size_t max_size = 0;
+    for (size_t k = 0; k < num_docs; ++k) {
+        max_size = std::max(max_size, docs[k]->size());
+    }
+    for (size_t i = 0; i < max_size; ++i) {
+        for (size_t k = 0; k < num_docs; ++k) {
+            LDADoc& doc = *docs[k];
+            if (i >= doc.size()) {
+                continue;
+            }
+            prefetch_ahead(doc, nullptr, i, distance);
+            Token& token = doc.token(i);
+            int new_topic = sample_token(doc, token, word_alias(token.id), *contexts[k]);
+            doc.set_topic(i, new_topic);
+        }
+    }
+}
 
-void MHSampler::sample_doc(SLDADoc& doc) {
+template <int MHSteps, typename TopicId>
+void MHSampler<MHSteps, TopicId>::sample_doc(SLDADoc& doc,
+                                             InferenceContext& context) const {
     int new_topic = 0;
     for (size_t i = 0; i < doc.size(); ++i) {
-        new_topic = sample_sentence(doc, doc.sent(i));
+        new_topic = sample_sentence(doc, doc.sent(i), context);
         doc.set_topic(i, new_topic);
     }
 }
 
-int MHSampler::propose(int word_id) {
+template <int MHSteps, typename TopicId>
+int MHSampler<MHSteps, TopicId>::propose(const WordAlias& alias,
+                                         InferenceContext& context) const {
     // 决定是否要从先验参数的alias table生成一个样本
-    double dart = rand() * (_prob_sum[word_id] + _beta_prior_sum);
+    double dart = context.rand() * (alias.prob_sum + _beta_prior_sum);
     int topic = -1;
-    if (dart < _prob_sum[word_id]) {
-        int idx = _alias_tables[word_id].generate(); // 从alias table中生成一个样本
-        topic = _topic_indexes[word_id][idx]; // 找到当前idx对应的真实主题id
+    if (dart < alias.prob_sum) {
+        // 从alias table中生成一个样本, 表项中直接存放了真实主题id
+        topic = sample_alias_entries(alias.entries, alias.size, context.rand());
     } else { // 命中先验概率部分
-        // 先验alias table为稠密分布，无需再做ID映射
-        topic = _beta_alias.generate();
+        topic = sample_alias_entries(_beta_alias.data(), _beta_alias.size(), context.rand());
     }
 
     return topic;
 }
 
-int MHSampler::sample_token(LDADoc& doc, Token& token) {
+template <int MHSteps, typename TopicId>
+int MHSampler<MHSteps, TopicId>::sample_token(LDADoc& doc,
+                                              Token& token,
+                                              const WordAlias& alias,
+                                              InferenceContext& context) const {
     int new_topic = token.topic;
-    for (int i = 0; i < _mh_steps; ++i) {
-        int doc_proposed_topic = doc_proposal(doc, token);
-        new_topic = word_proposal(doc, token, doc_proposed_topic);
+    for (int i = 0; i < MHSteps; ++i) {
+        int doc_proposed_topic = doc_proposal(doc, token, alias, context);
+        new_topic = word_proposal(doc, token, alias, doc_proposed_topic, context);
     }
 
     return new_topic;
 }
 
-int MHSampler::sample_sentence(SLDADoc& doc, Sentence& sent) {
+template <int MHSteps, typename TopicId>
+int MHSampler<MHSteps, TopicId>::sample_sentence(SLDADoc& doc,
+                                                 const SentenceView& sent,
+                                                 InferenceContext& context) const {
     int new_topic = sent.topic;
-    for (int i = 0; i < _mh_steps; ++i) { 
-        int doc_proposed_topic = doc_proposal(doc, sent);
-        new_topic = word_proposal(doc, sent, doc_proposed_topic);
+    for (int i = 0; i < MHSteps; ++i) { 
+        int doc_proposed_topic = doc_proposal(doc, sent, context);
+        new_topic = word_proposal(doc, sent, doc_proposed_topic, context);
     }
 
     return new_topic;
 }
 
-int MHSampler::doc_proposal(LDADoc& doc, Token& token) {
+template <int MHSteps, typename TopicId>
+int MHSampler<MHSteps, TopicId>::doc_proposal(LDADoc& doc,
+                                              Token& token,
+                                              const WordAlias& alias,
+                                              InferenceContext& context) const {
     int old_topic = token.topic;
     int new_topic = old_topic;
 
-    double dart = rand() * (doc.size() + _model->alpha_sum());
+    double dart = context.rand() * (doc.size() + _model->alpha_sum());
     if (dart < doc.size()) {
         int token_index = static_cast<int>(dart);
         new_topic = doc.token(token_index).topic;
     } else {
         // 命中文档先验部分, 则随机进行主题采样
-        new_topic = rand_k(_model->num_topics());
+        new_topic = context.rand_k(_model->num_topics());
     }
 
     if (new_topic != old_topic) {
         float proposal_old = doc_proposal_distribution(doc, old_topic);
         float proposal_new = doc_proposal_distribution(doc, new_topic);
-        float proportion_old = proportional_funtion(doc, token, old_topic);
-        float proportion_new = proportional_funtion(doc, token, new_topic);
+        float proportion_old = proportional_funtion(doc, token, alias, old_topic);
+        float proportion_new = proportional_funtion(doc, token, alias, new_topic);
         double transition_prob = (proportion_new * proposal_old) / (proportion_old * proposal_new);
-        double rejection = rand();
+        double rejection = context.rand();
         int mask = -(rejection < transition_prob); 
         return (new_topic & mask) | (old_topic & ~mask); // 用位运算避免if分支判断
     }
@@ -83,26 +176,30 @@ int MHSampler::doc_proposal(LDADoc& doc, Token& token) {
     return new_topic;
 }
 
-int MHSampler::doc_proposal(SLDADoc& doc, Sentence& sent) {
+template <int MHSteps, typename TopicId>
+int MHSampler<MHSteps, TopicId>::doc_proposal(SLDADoc& doc,
+                                              const SentenceView& sent,
+                                              InferenceContext& context) const {
     int old_topic = sent.topic;
     int new_topic = -1;
 
-    double dart = rand() * (doc.size() + _model->alpha_sum());
+    double dart = context.rand() * (doc.size() + _model->alpha_sum());
     if (dart < doc.size()) {
         int token_index = static_cast<int>(dart);
-        new_topic = doc.sent(token_index).topic;
+        new_topic = doc.sent_topic(token_index);
     } else {
         // 命中文档先验部分, 则随机进行主题采样
-        new_topic = rand_k(_model->num_topics());
+        new_topic = context.rand_k(_model->num_topics());
     }
 
     if (new_topic != old_topic) {
-        float proportion_old = proportional_funtion(doc, sent, old_topic);
-        float proportion_new = proportional_funtion(doc, sent, new_topic);
+        double log_proportion_old = log_proportional_function(doc, sent, old_topic);
+        double log_proportion_new = log_proportional_function(doc, sent, new_topic);
         float proposal_old = doc_proposal_distribution(doc, old_topic);
         float proposal_new = doc_proposal_distribution(doc, new_topic);
-        double transition_prob = (proportion_new * proposal_old) / (proportion_old * proposal_new);
-        double rejection = rand();
+        double transition_prob = std::exp(log_proportion_new - log_proportion_old)
+                                 * proposal_old / proposal_new;
+        double rejection = context.rand();
         int mask = -(rejection < transition_prob);
         return (new_topic & mask) | (old_topic & ~mask);
     }
@@ -110,15 +207,23 @@ int MHSampler::doc_proposal(SLDADoc& doc, Sentence& sent) {
     return new_topic;
 }
 
-int MHSampler::word_proposal(LDADoc& doc, Token& token, int old_topic) {
-    int new_topic = propose(token.id); // prpose a new topic from alias table
+template <int MHSteps, typename TopicId>
+int MHSampler<MHSteps, TopicId>::word_proposal(LDADoc& doc,
+                                               Token& token,
+                                               const WordAlias& alias,
+                                               int old_topic,
+                                               InferenceContext& context) const {
+    int new_topic = propose(alias, context); // prpose a new topic from alias table
     if (new_topic != old_topic) {
-        float proposal_old = word_proposal_distribution(token.id, old_topic);
-        float proposal_new = word_proposal_distribution(token.id, new_topic);
-        float proportion_old = proportional_funtion(doc, token, old_topic);
-        float proportion_new = proportional_funtion(doc, token, new_topic);
+        float proposal_old = word_prob(alias, token.id, old_topic);
+        float proposal_new = word_prob(alias, token.id, new_topic);
+        float proportion_old = proportional_funtion(doc, token, alias, old_topic);
+        // 主题不是词的当前主题时无需扣除自身计数, 可直接复用proposal_new中的phi
+        float proportion_new = new_topic != token.topic
+                               ? doc_proposal_distribution(doc, new_topic) * proposal_new
+                               : proportional_funtion(doc, token, alias, new_topic);
         double transition_prob = (proportion_new * proposal_old) / (proportion_old * proposal_new);
-        double rejection = rand();
+        double rejection = context.rand();
         int mask = -(rejection < transition_prob);
         return (new_topic & mask) | (old_topic & ~mask);
     }
@@ -127,19 +232,29 @@ int MHSampler::word_proposal(LDADoc& doc, Token& token, int old_topic) {
 }
 
 // word proposal for Sentence-LDA
-int MHSampler::word_proposal(SLDADoc& doc, Sentence& sent, int old_topic) {
+template <int MHSteps, typename TopicId>
+int MHSampler<MHSteps, TopicId>::word_proposal(SLDADoc& doc,
+                                               const SentenceView& sent,
+                                               int old_topic,
+                                               InferenceContext& context) const {
     int new_topic = old_topic;
+    // 循环中old_topic及文档状态不变, 其对数概率只需计算一次
+    bool has_log_proportion_old = false;
+    double log_proportion_old = 0.0;
     for (const auto& word_id : sent.tokens) {
-        new_topic = propose(word_id); // prpose a new topic from alias table
+        new_topic = propose(word_id, context); // prpose a new topic from alias table
         if (new_topic != old_topic) {
-            float proportion_old = proportional_funtion(doc, sent, old_topic);
-            float proportion_new = proportional_funtion(doc, sent, new_topic);
+            if (!has_log_proportion_old) {
+                log_proportion_old = log_proportional_function(doc, sent, old_topic);
+                has_log_proportion_old = true;
+            }
+            double log_proportion_new = log_proportional_function(doc, sent, new_topic);
             float proposal_old = word_proposal_distribution(word_id, old_topic);
             float proposal_new = word_proposal_distribution(word_id, new_topic);
-            double transition_prob = (proportion_new * proposal_old) / 
-                                     (proportion_old * proposal_new);
+            double transition_prob = std::exp(log_proportion_new - log_proportion_old)
+                                     * proposal_old / proposal_new;
 
-            double rejection = rand();
+            double rejection = context.rand();
             int mask = -(rejection < transition_prob);
             new_topic = (new_topic & mask) | (old_topic & ~mask);
         }
@@ -148,10 +263,17 @@ int MHSampler::word_proposal(SLDADoc& doc, Sentence& sent, int old_topic) {
     return new_topic;
 }
 
-float MHSampler::proportional_funtion(LDADoc& doc, Token& token, int new_topic) {
+template <int MHSteps, typename TopicId>
+float MHSampler<MHSteps, TopicId>::proportional_funtion(LDADoc& doc,
+                                                       Token& token,
+                                                       const WordAlias& alias,
+                                                       int new_topic) const {
     int old_topic = token.topic;
     float dt_alpha = doc.topic_sum(new_topic) + _model->alpha();
-    float wt_beta = _model->word_topic(token.id, new_topic) + _model->beta();
+    if (new_topic != old_topic) {
+        return dt_alpha * word_prob(alias, token.id, new_topic);
+    }
+    float wt_beta = word_count(alias, token.id, new_topic) + _model->beta();
     float t_sum_beta_sum = _model->topic_sum(new_topic) + _model->beta_sum();
     if (new_topic == old_topic && wt_beta > 1) {
         if (dt_alpha > 1) {
@@ -164,61 +286,71 @@ float MHSampler::proportional_funtion(LDADoc& doc, Token& token, int new_topic)
     return dt_alpha * wt_beta / t_sum_beta_sum;
 }
 
-float MHSampler::proportional_funtion(SLDADoc& doc, Sentence& sent, int new_topic) {
+template <int MHSteps, typename TopicId>
+double MHSampler<MHSteps, TopicId>::log_proportional_function(SLDADoc& doc,
+                                                              const SentenceView& sent,
+                                                              int new_topic) const {
     int old_topic = sent.topic;
-    float result = doc.topic_sum(new_topic) + _model->alpha();
+    double dt_alpha = doc.topic_sum(new_topic) + _model->alpha();
     if (new_topic == old_topic) {
-        result -= 1;
+        dt_alpha -= 1;
+    }
+    double result = std::log(dt_alpha);
+    double log_t_sum_beta_sum = _model->log_topic_denominator(new_topic);
+    // 当前主题需扣除自身计数, 此时分母为topic_sum + beta_sum - 1
+    double log_old_t_sum_beta_sum = 0.0;
+    if (new_topic == old_topic) {
+        log_old_t_sum_beta_sum = std::log(_model->topic_sum(new_topic)
+                                          + static_cast<double>(_model->beta_sum()) - 1);
     }
     for (const auto& word_id : sent.tokens) {
-        float wt_beta = _model->word_topic(word_id, new_topic) + _model->beta();
-        float t_sum_beta_sum = _model->topic_sum(new_topic) + _model->beta_sum();
+        int word_topic = _model->word_topic(word_id, new_topic);
+        double wt_beta = word_topic + static_cast<double>(_model->beta());
         if (new_topic == old_topic && wt_beta > 1) {
-            wt_beta -= 1;
-            t_sum_beta_sum -= 1;
+            result += std::log(wt_beta - 1) - log_old_t_sum_beta_sum;
+        } else {
+            result += log_word_beta(word_topic) - log_t_sum_beta_sum;
         }
-
-        result *= wt_beta / t_sum_beta_sum;
     }
 
     return result;
 }
 
-float MHSampler::doc_proposal_distribution(LDADoc& doc, int topic) {
+template <int MHSteps, typename TopicId>
+float MHSampler<MHSteps, TopicId>::doc_proposal_distribution(LDADoc& doc, int topic) const {
     return doc.topic_sum(topic) + _model->alpha();
 }
 
-float MHSampler::word_proposal_distribution(int word_id, int topic) {
-    float wt_beta = _model->word_topic(word_id, topic) + _model->beta();
-    float t_sum_beta_sum = _model->topic_sum(topic) + _model->beta_sum();
-    
-    return wt_beta / t_sum_beta_sum;
+template <int MHSteps, typename TopicId>
+float MHSampler<MHSteps, TopicId>::word_proposal_distribution(int word_id, int topic) const {
+    return _model->word_topic_prob(word_id, topic);
+}
+
+template <int MHSteps, typename TopicId>
+void MHSampler<MHSteps, TopicId>::build_log_word_beta() {
+    _log_word_beta.resize(4096);
+    for (size_t c = 0; c < _log_word_beta.size(); ++c) {
+        _log_word_beta[c] = std::log(c + static_cast<double>(_model->beta()));
+    }
 }
 
-int MHSampler::construct_alias_table() {
+template <int MHSteps, typename TopicId>
+int MHSampler<MHSteps, TopicId>::construct_alias_table() {
     size_t vocab_size = _model->vocab_size();
-    _topic_indexes = std::vector<TopicIndex>(vocab_size);
-    _alias_tables = std::vector<VoseAlias>(vocab_size);
-    _prob_sum = std::vector<double>(vocab_size);
-
-    // 构建每个词的alias table (不包含先验部分)
-    std::vector<double> dist;
-    for (size_t i = 0; i < vocab_size; ++i) {
-        dist.clear();
-        double prob_sum = 0;
-        for (auto& iter : _model->word_topic(i)) {
-            int topic_id = iter.first; // topic index
-            int word_topic_count = iter.second; // topic count
-            size_t topic_sum = _model->topic_sum(topic_id); // topic sum
-            
-            _topic_indexes[i].push_back(topic_id);
-            double q = word_topic_count / (topic_sum + _model->beta_sum());
-            dist.push_back(q);
-            prob_sum += q;
-        }
-        _prob_sum[i] = prob_sum;
-        if (dist.size() > 0) {
-            _alias_tables[i].initialize(dist);
+    // 不做值初始化, lazy模式下未使用的词不会占用物理内存
+    _alias_arena.reset(new Entry[_model->num_nonzeros()]);
+    _alias_entries = _alias_arena.get();
+    _prob_sum_storage = std::vector<double>(vocab_size);
+    _prob_sum = _prob_sum_storage.data();
+    _num_materialized = 0;
+
+    if (_lazy) {
+        _alias_states = std::vector<std::atomic<uint8_t>>(vocab_size);
+        LOG(INFO) << "Word alias tables will be constructed on demand.";
+    } else {
+        // 构建每个词的alias table (不包含先验部分)
+        for (size_t i = 0; i < vocab_size; ++i) {
+            build_word_alias_table(i);
         }
     }
 
@@ -229,109 +361,657 @@ int MHSampler::construct_alias_table() {
         beta_dist[i] = _model->beta() / (_model->topic_sum(i) + _model->beta_sum());
         _beta_prior_sum += beta_dist[i];
     }
-    _beta_alias.initialize(beta_dist);
+    _beta_alias.resize(_model->num_topics());
+    build_alias_entries(beta_dist, nullptr, _beta_alias.data());
+
+    return 0;
+}
+
+template <int MHSteps, typename TopicId>
+void MHSampler<MHSteps, TopicId>::build_word_alias_table(int word_id) const {
+    WordTopicRow row = _model->word_topic(word_id);
+    std::vector<double> dist(row.size);
+    std::vector<int32_t> topics(row.size);
+    double prob_sum = 0;
+    for (size_t j = 0; j < row.size; ++j) {
+        int topic_id = row.topic(j); // topic index
+        int word_topic_count = row.count(j); // topic count
+        size_t topic_sum = _model->topic_sum(topic_id); // topic sum
+
+        topics[j] = topic_id;
+        dist[j] = word_topic_count / (topic_sum + _model->beta_sum());
+        prob_sum += dist[j];
+    }
+    _prob_sum_storage[word_id] = prob_sum;
+    if (row.size > 0) {
+        build_alias_entries(dist, topics.data(),
+                            _alias_arena.get() + _model->word_topic_offset(word_id));
+    }
+    _num_materialized.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <int MHSteps, typename TopicId>
+void MHSampler<MHSteps, TopicId>::materialize_alias_table(int word_id) const {
+    auto& state = _alias_states[word_id];
+    uint8_t expected = ALIAS_EMPTY;
+    if (state.compare_exchange_strong(expected, ALIAS_BUILDING, std::memory_order_acquire)) {
+        build_word_alias_table(word_id);
+        state.store(ALIAS_READY, std::memory_order_release);
+        return;
+    }
+    // 其他线程正在构建, 等待构建完成
+    while (state.load(std::memory_order_acquire) != ALIAS_READY) {
+        std::this_thread::yield();
+    }
+}
+
+template <int MHSteps, typename TopicId>
+int MHSampler<MHSteps, TopicId>::load_alias_table(const std::string& alias_table_path) {
+    MappedFile& file = _mapped_file;
+    if (access(alias_table_path.c_str(), R_OK) != 0 || file.open(alias_table_path) != 0) {
+        LOG(INFO) << "Alias table file " << alias_table_path << " not found, rebuild it.";
+        return -1;
+    }
+    const AliasTableHeader* header = reinterpret_cast<const AliasTableHeader*>(file.data());
+    size_t vocab_size = _model->vocab_size();
+    size_t num_topics = _model->num_topics();
+    size_t nnz = _model->num_nonzeros();
+    size_t expected_size = sizeof(AliasTableHeader)
+                           + sizeof(double) * vocab_size
+                           + sizeof(Entry) * (num_topics + nnz);
+    if (file.size() != expected_size
+        || !std::equal(ALIAS_TABLE_MAGIC, ALIAS_TABLE_MAGIC + sizeof(ALIAS_TABLE_MAGIC),
+                       header->magic)
+        || header->version != ALIAS_TABLE_VERSION
+        || header->num_topics != num_topics
+        || header->vocab_size != vocab_size
+        || header->num_nonzeros != nnz
+        || header->model_checksum != _model->checksum()) {
+        LOG(WARNING) << "Alias table file " << alias_table_path
+                     << " mismatch with current model, rebuild it.";
+        file.close();
+        return -1;
+    }
+
+    _prob_sum = reinterpret_cast<const double*>(file.data() + sizeof(*header));
+    const Entry* beta_entries = reinterpret_cast<const Entry*>(_prob_sum + vocab_size);
+    _beta_alias.assign(beta_entries, beta_entries + num_topics);
+    _alias_entries = beta_entries + num_topics;
+    _beta_prior_sum = header->beta_prior_sum;
+    _num_materialized = vocab_size;
+
+    LOG(INFO) << "Load alias table from " << alias_table_path << " successfully!";
+    return 0;
+}
+
+template <int MHSteps, typename TopicId>
+int MHSampler<MHSteps, TopicId>::save_alias_table(const std::string& alias_table_path) const {
+    // 先写入临时文件再重命名, 避免多个进程同时启动时读到不完整的文件
+    std::string tmp_path = alias_table_path + ".tmp." + std::to_string(getpid());
+    std::ofstream fout(tmp_path.c_str(), std::ios::out | std::ios::binary);
+    if (!fout) {
+        LOG(WARNING) << "Failed to create alias table file: " << alias_table_path;
+        return -1;
+    }
+    AliasTableHeader header;
+    std::copy(ALIAS_TABLE_MAGIC, ALIAS_TABLE_MAGIC + sizeof(ALIAS_TABLE_MAGIC), header.magic);
+    header.version = ALIAS_TABLE_VERSION;
+    header.num_topics = _model->num_topics();
+    header.vocab_size = _model->vocab_size();
+    header.num_nonzeros = _model->num_nonzeros();
+    header.model_checksum = _model->checksum();
+    header.beta_prior_sum = _beta_prior_sum;
+    fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    fout.write(reinterpret_cast<const char*>(_prob_sum), sizeof(double) * header.vocab_size);
+    fout.write(reinterpret_cast<const char*>(_beta_alias.data()),
+               sizeof(Entry) * _beta_alias.size());
+    fout.write(reinterpret_cast<const char*>(_alias_entries),
+               sizeof(Entry) * header.num_nonzeros);
+    fout.close();
+    if (!fout || rename(tmp_path.c_str(), alias_table_path.c_str()) != 0) {
+        LOG(WARNING) << "Failed to write alias table file: " << alias_table_path;
+        remove(tmp_path.c_str());
+        return -1;
+    }
 
+    LOG(INFO) << "Save alias table to " << alias_table_path << " successfully!";
     return 0;
 }
 
-void GibbsSampler::sample_doc(LDADoc& doc) {
+template class MHSampler<1, uint16_t>;
+template class MHSampler<2, uint16_t>;
+template class MHSampler<3, uint16_t>;
+template class MHSampler<4, uint16_t>;
+template class MHSampler<1, int32_t>;
+template class MHSampler<2, int32_t>;
+template class MHSampler<3, int32_t>;
+template class MHSampler<4, int32_t>;
+
+GibbsSampler::GibbsSampler(std::shared_ptr<TopicModel> model) : _model(model) {
+    const std::vector<double>& inv_topic_denominator = _model->inv_topic_denominator();
+    _inv_topic_denominator.assign(inv_topic_denominator.begin(), inv_topic_denominator.end());
+    const std::vector<double>& log_topic_denominator = _model->log_topic_denominator();
+    _log_topic_denominator.assign(log_topic_denominator.begin(), log_topic_denominator.end());
+    _log_word_count.resize(_log_table_size);
+    for (int c = 0; c < _log_table_size; ++c) {
+        _log_word_count[c] = std::log(c + static_cast<double>(_model->beta()))
+                             - std::log(static_cast<double>(_model->beta()));
+    }
+    _log_doc_count.resize(_log_table_size);
+    for (int c = 0; c < _log_table_size; ++c) {
+        _log_doc_count[c] = std::log(c + static_cast<double>(_model->alpha()))
+                            - std::log(static_cast<double>(_model->alpha()));
+    }
+    LOG(INFO) << "Gibbs sampling kernel: " << gibbs_kernel_name();
+}
+
+void GibbsSampler::sample_doc(LDADoc& doc, InferenceContext& context) const {
     int new_topic = -1;
     for (size_t i = 0; i < doc.size(); ++i) {
-        new_topic = sample_token(doc, doc.token(i));
+        new_topic = sample_token(doc, doc.token(i), context);
         doc.set_topic(i, new_topic);
     }
 }
 
-void GibbsSampler::sample_doc(SLDADoc& doc) {
+void GibbsSampler::sample_doc_by_word(LDADoc& doc,
+                                      const std::vector<int>& order,
+                                      InferenceContext& context) const {
+    int num_topics = _model->num_topics();
+    size_t i = 0;
+    while (i < order.size()) {
+        int word_id = doc.token(order[i]).id;
+        size_t end = i + 1;
+        while (end < order.size() && doc.token(order[end]).id == word_id) {
+            ++end;
+        }
+        if (end - i == 1) {
+            doc.set_topic(order[i], sample_token(doc, doc.token(order[i]), context));
+            i = end;
+            continue;
+        }
+        // 组内各主题的概率只在文档主题计数变化的两个主题上更新
+        const int32_t* word_counts = expand_word_topic(word_id, context);
+        std::vector<float>& prob = context.prob_buffer(num_topics);
+        gibbs_token_prob(doc.topic_sum().data(), word_counts, _inv_topic_denominator.data(),
+                         _model->alpha(), _model->beta(), num_topics, prob.data());
+        for (; i < end; ++i) {
+            int old_topic = doc.token(order[i]).topic;
+            int new_topic = sample_repeated_token(doc, old_topic, word_counts, prob, context);
+            if (new_topic != old_topic) {
+                doc.set_topic(order[i], new_topic);
+                prob[old_topic] = token_prob(doc, word_counts, old_topic);
+                prob[new_topic] = token_prob(doc, word_counts, new_topic);
+            }
+        }
+        clear_word_topic(word_id, context);
+    }
+}
+
+void GibbsSampler::sample_doc(SLDADoc& doc, InferenceContext& context) const {
     int new_topic = -1;
     for (size_t i = 0; i < doc.size(); ++i) {
-        new_topic = sample_sentence(doc, doc.sent(i));
+        new_topic = sample_sentence(doc, doc.sent(i), context);
         doc.set_topic(i, new_topic);
     }
 }
 
-int GibbsSampler::sample_token(LDADoc& doc, Token& token) {
+const int32_t* GibbsSampler::expand_word_topic(int word_id, InferenceContext& context) const {
+    const int32_t* dense_row = _model->dense_row(word_id);
+    if (dense_row != nullptr) {
+        return dense_row;
+    }
+    std::vector<int32_t>& counts = context.count_buffer(_model->num_topics());
+    WordTopicRow row = _model->word_topic(word_id);
+    for (size_t i = 0; i < row.size; ++i) {
+        counts[row.topic(i)] = row.count(i);
+    }
+    return counts.data();
+}
+
+void GibbsSampler::clear_word_topic(int word_id, InferenceContext& context) const {
+    if (_model->dense_row(word_id) != nullptr) {
+        return;
+    }
+    std::vector<int32_t>& counts = context.count_buffer(_model->num_topics());
+    WordTopicRow row = _model->word_topic(word_id);
+    for (size_t i = 0; i < row.size; ++i) {
+        counts[row.topic(i)] = 0;
+    }
+}
+
+int GibbsSampler::search_topic(const std::vector<float>& accum_prob, int num_topics, double dart) {
+    auto it = std::lower_bound(accum_prob.begin(), accum_prob.begin() + num_topics, dart,
+                               [](float prob, double value) { return prob < value; });
+    if (it == accum_prob.begin() + num_topics) {
+        return num_topics - 1; // 返回最后一个主题id
+    }
+    return static_cast<int>(it - accum_prob.begin());
+}
+
+int GibbsSampler::sample_token(LDADoc& doc, Token& token, InferenceContext& context) const {
     int old_topic = token.topic;
     int num_topics = _model->num_topics();
-    std::vector<float> accum_prob(num_topics, 0.0);
-    std::vector<float> prob(num_topics, 0.0);
+    std::vector<float>& accum_prob = context.accum_prob_buffer(num_topics);
+    std::vector<float>& prob = context.prob_buffer(num_topics);
+    // 向量化计算各主题的条件概率, 词的主题计数预先展开为稠密形式避免逐主题二分查找
+    const int32_t* word_counts = expand_word_topic(token.id, context);
+    gibbs_token_prob(doc.topic_sum().data(), word_counts, _inv_topic_denominator.data(),
+                     _model->alpha(), _model->beta(), num_topics, prob.data());
+    // 当前主题需扣除当前词自身的计数
+    float dt_alpha = doc.topic_sum(old_topic) + _model->alpha();
+    float wt_beta = word_counts[old_topic] + _model->beta();
+    float t_sum_beta_sum = _model->topic_sum(old_topic) + _model->beta_sum();
+    clear_word_topic(token.id, context);
+    if (wt_beta > 1) {
+        if (dt_alpha > 1) {
+            dt_alpha -= 1;
+        }
+        wt_beta -= 1;
+        t_sum_beta_sum -= 1;
+        prob[old_topic] = dt_alpha * wt_beta / t_sum_beta_sum;
+    }
+
     float sum = 0.0;
-    float dt_alpha = 0.0;
-    float wt_beta = 0.0;
-    float t_sum_beta_sum = 0.0;
     for (int t = 0; t < num_topics; ++t) {
-        dt_alpha = doc.topic_sum(t) + _model->alpha();
-        wt_beta = _model->word_topic(token.id, t) + _model->beta();
-        t_sum_beta_sum = _model->topic_sum(t) + _model->beta_sum();
-        if (t == old_topic && wt_beta > 1) {
-            if (dt_alpha > 1) {
-                dt_alpha -= 1;
-            }
-            wt_beta -= 1;
-            t_sum_beta_sum -= 1;
-        }
-        prob[t] = dt_alpha * wt_beta / t_sum_beta_sum;
         sum += prob[t];
-        accum_prob[t] = (t == 0 ? prob[t] : accum_prob[t - 1] + prob[t]);
+        accum_prob[t] = sum;
     }
     
-    double dart = rand() * sum;
-    if (dart <= accum_prob[0]) {
-        return 0;
-    }
-    for (int t = 1; t < num_topics; ++t) {
-        if (dart > accum_prob[t - 1] && dart <= accum_prob[t]) {
-            return t;
+    double dart = context.rand() * sum;
+    return search_topic(accum_prob, num_topics, dart);
+}
+
+int GibbsSampler::sample_repeated_token(LDADoc& doc,
+                                        int old_topic,
+                                        const int32_t* word_counts,
+                                        std::vector<float>& prob,
+                                        InferenceContext& context) const {
+    int num_topics = _model->num_topics();
+    std::vector<float>& accum_prob = context.accum_prob_buffer(num_topics);
+    // 当前主题需扣除当前词自身的计数, 采样后恢复
+    float old_prob = prob[old_topic];
+    float dt_alpha = doc.topic_sum(old_topic) + _model->alpha();
+    float wt_beta = word_counts[old_topic] + _model->beta();
+    float t_sum_beta_sum = _model->topic_sum(old_topic) + _model->beta_sum();
+    if (wt_beta > 1) {
+        if (dt_alpha > 1) {
+            dt_alpha -= 1;
         }
+        wt_beta -= 1;
+        t_sum_beta_sum -= 1;
+        prob[old_topic] = dt_alpha * wt_beta / t_sum_beta_sum;
     }
 
-    return num_topics - 1; // 返回最后一个主题id
+    float sum = 0.0;
+    for (int t = 0; t < num_topics; ++t) {
+        sum += prob[t];
+        accum_prob[t] = sum;
+    }
+    prob[old_topic] = old_prob;
+
+    double dart = context.rand() * sum;
+    return search_topic(accum_prob, num_topics, dart);
 }
 
-int GibbsSampler::sample_sentence(SLDADoc& doc, Sentence& sent) {
+int GibbsSampler::sample_sentence(SLDADoc& doc,
+                                  const SentenceView& sent,
+                                  InferenceContext& context) const {
     int old_topic = sent.topic;
     int num_topics = _model->num_topics();
-    std::vector<float> accum_prob(num_topics, 0.0);
-    std::vector<float> prob(num_topics, 0.0);
+    std::vector<float>& accum_prob = context.accum_prob_buffer(num_topics);
+    std::vector<float>& log_prob = context.prob_buffer(num_topics);
+    // 在对数空间中计算各主题的条件概率, 避免长句子连乘导致的下溢:
+    // log p(t) = log(n_dt + alpha) + sum_w log(n_wt + beta) - L * log(n_t + beta_sum)
+    // 先按文档及词计数均为0向量化计算所有主题, 再只对非零计数进行修正
+    float alpha = _model->alpha();
+    float beta = _model->beta();
+    float log_alpha = std::log(alpha);
+    float log_beta = std::log(beta);
+    float num_words = sent.tokens.size();
+    gibbs_log_prob(_log_topic_denominator.data(), num_words, log_alpha + num_words * log_beta,
+                   num_topics, log_prob.data());
+    const std::vector<int>& doc_topic_sum = doc.topic_sum();
+    if (doc.size() < static_cast<size_t>(_log_table_size)) {
+        // 文档主题计数不超过句子数, 可直接查表, 循环无分支
+        for (int t = 0; t < num_topics; ++t) {
+            log_prob[t] += _log_doc_count[doc_topic_sum[t]];
+        }
+    } else {
+        for (int t = 0; t < num_topics; ++t) {
+            if (doc_topic_sum[t] != 0) {
+                log_prob[t] += std::log(doc_topic_sum[t] + alpha) - log_alpha;
+            }
+        }
+    }
+    // 当前主题需扣除自身计数, 单独计算; 其词计数在扫描非零项时一并取得
+    double old_word_log_prob = 0.0;
+    size_t old_word_hits = 0;
+    for (const auto& word_id : sent.tokens) {
+        WordTopicRow row = _model->word_topic(word_id);
+        for (size_t i = 0; i < row.size; ++i) {
+            int topic = row.topic(i);
+            int count = row.count(i);
+            log_prob[topic] += count < _log_table_size ? _log_word_count[count]
+                                                       : std::log(count + beta) - log_beta;
+            if (topic == old_topic) {
+                double wt_beta = count + static_cast<double>(beta);
+                old_word_log_prob += std::log(wt_beta > 1 ? wt_beta - 1 : wt_beta);
+                ++old_word_hits;
+            }
+        }
+    }
+    double dt_alpha = doc.topic_sum(old_topic) + alpha;
+    if (dt_alpha > 1) {
+        dt_alpha -= 1;
+    }
+    double t_sum_beta_sum = _model->topic_sum(old_topic) + static_cast<double>(_model->beta_sum());
+    if (t_sum_beta_sum > 1) {
+        t_sum_beta_sum -= 1;
+    }
+    // 不含当前主题的词计数为0, 对应n_wt + beta = beta
+    double zero_wt_beta = beta > 1 ? beta - 1.0 : static_cast<double>(beta);
+    log_prob[old_topic] = std::log(dt_alpha) - num_words * std::log(t_sum_beta_sum)
+                          + old_word_log_prob
+                          + (num_words - old_word_hits) * std::log(zero_wt_beta);
+
+    // log-sum-exp: 减去最大值后再向量化地取指数, 保证数值稳定
+    float max_log_prob = log_prob[0];
+    for (int t = 1; t < num_topics; ++t) {
+        max_log_prob = std::max(max_log_prob, log_prob[t]);
+    }
+    gibbs_exp_prob(max_log_prob, num_topics, log_prob.data());
     float sum = 0.0;
-    float dt_alpha = 0.0;
-    float t_sum_beta_sum = 0.0;
-    float wt_beta = 0.0;
-    // 为了保证数值计算的稳定，以下实现为SentenceLDA的采样近似实现
     for (int t = 0; t < num_topics; ++t) {
-        dt_alpha = doc.topic_sum(t) + _model->alpha();
-        t_sum_beta_sum = _model->topic_sum(t) + _model->beta_sum();
+        sum += log_prob[t];
+        accum_prob[t] = sum;
+    }
+    double dart = context.rand() * sum;
+    return search_topic(accum_prob, num_topics, dart);
+}
+
+SparseGibbsSampler::SparseGibbsSampler(std::shared_ptr<TopicModel> model)
+    : _model(model), _exact_sampler(model) {
+    int num_topics = _model->num_topics();
+    double alpha_beta = static_cast<double>(_model->alpha()) * _model->beta();
+    _inv_denominator.resize(num_topics);
+    _smoothing_prefix.resize(num_topics + 1);
+    _smoothing_prefix[0] = 0.0;
+    for (int t = 0; t < num_topics; ++t) {
+        _inv_denominator[t] = _model->inv_topic_denominator(t);
+        _smoothing_prefix[t + 1] = _smoothing_prefix[t] + alpha_beta * _inv_denominator[t];
+    }
+}
+
+void SparseGibbsSampler::sample_doc(LDADoc& doc, InferenceContext& context) const {
+    // 收集文档中计数非零的主题并计算文档项之和, 此后随采样结果增量更新
+    std::vector<int>& doc_topics = context.topic_buffer();
+    doc_topics.clear();
+    for (size_t i = 0; i < doc.size(); ++i) {
+        doc_topics.push_back(doc.token(i).topic);
+    }
+    std::sort(doc_topics.begin(), doc_topics.end());
+    doc_topics.erase(std::unique(doc_topics.begin(), doc_topics.end()), doc_topics.end());
+    double beta = _model->beta();
+    double doc_bucket_sum = 0.0;
+    for (int t : doc_topics) {
+        doc_bucket_sum += doc.topic_sum(t) * beta * _inv_denominator[t];
+    }
+
+    for (size_t i = 0; i < doc.size(); ++i) {
+        int old_topic = doc.token(i).topic;
+        int new_topic = sample_token(doc, doc.token(i), doc_topics, doc_bucket_sum, context);
+        if (new_topic == old_topic) {
+            continue;
+        }
+        doc.set_topic(i, new_topic);
+        doc_bucket_sum += beta * (_inv_denominator[new_topic] - _inv_denominator[old_topic]);
+        if (doc.topic_sum(old_topic) == 0) {
+            auto it = std::find(doc_topics.begin(), doc_topics.end(), old_topic);
+            *it = doc_topics.back();
+            doc_topics.pop_back();
+        }
+        if (doc.topic_sum(new_topic) == 1) {
+            doc_topics.push_back(new_topic);
+        }
+    }
+}
+
+void SparseGibbsSampler::sample_doc(SLDADoc& doc, InferenceContext& context) const {
+    _exact_sampler.sample_doc(doc, context);
+}
+
+int SparseGibbsSampler::sample_token(LDADoc& doc,
+                                     Token& token,
+                                     const std::vector<int>& doc_topics,
+                                     double doc_bucket_sum,
+                                     InferenceContext& context) const {
+    int old_topic = token.topic;
+    double alpha = _model->alpha();
+    double beta = _model->beta();
+
+    // 词项: 遍历词的非零主题, 跳过当前主题, 同时取得当前主题的词计数
+    WordTopicRow row = _model->word_topic(token.id);
+    std::vector<float>& word_prob = context.prob_buffer(row.size);
+    double word_bucket_sum = 0.0;
+    int old_word_count = 0;
+    for (size_t i = 0; i < row.size; ++i) {
+        int t = row.topic(i);
         if (t == old_topic) {
-            if (dt_alpha > 1) {
-                dt_alpha -= 1;
+            old_word_count = row.count(i);
+            word_prob[i] = 0.0;
+            continue;
+        }
+        word_prob[i] = (doc.topic_sum(t) + alpha) * row.count(i) * _inv_denominator[t];
+        word_bucket_sum += word_prob[i];
+    }
+
+    // 当前主题: 与GibbsSampler相同, 扣除当前词自身的计数后精确计算
+    double dt_alpha = doc.topic_sum(old_topic) + alpha;
+    double wt_beta = old_word_count + beta;
+    double t_sum_beta_sum = _model->topic_sum(old_topic) + _model->beta_sum();
+    if (wt_beta > 1) {
+        if (dt_alpha > 1) {
+            dt_alpha -= 1;
+        }
+        wt_beta -= 1;
+        t_sum_beta_sum -= 1;
+    }
+    double old_prob = dt_alpha * wt_beta / t_sum_beta_sum;
+
+    // 文档项及平滑项均扣除当前主题的部分
+    double doc_sum = std::max(0.0, doc_bucket_sum
+                                   - doc.topic_sum(old_topic) * beta * _inv_denominator[old_topic]);
+    double old_smoothing = _smoothing_prefix[old_topic + 1] - _smoothing_prefix[old_topic];
+    double smoothing_sum = _smoothing_prefix.back() - old_smoothing;
+
+    double dart = context.rand() * (old_prob + word_bucket_sum + doc_sum + smoothing_sum);
+    if (dart < old_prob) {
+        return old_topic;
+    }
+    dart -= old_prob;
+
+    if (dart < word_bucket_sum) {
+        int last = old_topic;
+        for (size_t i = 0; i < row.size; ++i) {
+            if (word_prob[i] <= 0.0) {
+                continue;
             }
-            if (t_sum_beta_sum > 1) {
-                t_sum_beta_sum -= 1;
+            last = row.topic(i);
+            dart -= word_prob[i];
+            if (dart < 0) {
+                return last;
             }
         }
-        prob[t] = dt_alpha;
-        for (size_t i = 0; i < sent.tokens.size(); ++i) {
-            int w = sent.tokens[i];
-            wt_beta = _model->word_topic(w, t) + _model->beta();
-            if (t == old_topic && wt_beta > 1) {
-                wt_beta -= 1;
+        return last; // 浮点误差导致未命中时返回最后一个非零项
+    }
+    dart -= word_bucket_sum;
+
+    if (dart < doc_sum) {
+        int last = old_topic;
+        for (int t : doc_topics) {
+            if (t == old_topic) {
+                continue;
+            }
+            last = t;
+            dart -= doc.topic_sum(t) * beta * _inv_denominator[t];
+            if (dart < 0) {
+                return last;
             }
-            // NOTE: 若句子长度过长，此处连乘项过多会导致概率过小, 丢失精度
-            prob[t] *= wt_beta / t_sum_beta_sum;
         }
-        sum += prob[t];
-        accum_prob[t] = (t == 0 ? prob[t] : accum_prob[t - 1] + prob[t]);
+        return last;
     }
-    double dart = rand() * sum;
-    if (dart <= accum_prob[0]) { 
-        return 0;
+    dart -= doc_sum;
+
+    // 平滑项: 在前缀和上二分查找, 位于当前主题之后的部分需跳过当前主题
+    double target = dart < _smoothing_prefix[old_topic] ? dart : dart + old_smoothing;
+    int num_topics = _model->num_topics();
+    int new_topic = static_cast<int>(std::upper_bound(_smoothing_prefix.begin(),
+                                                      _smoothing_prefix.end(),
+                                                      target) - _smoothing_prefix.begin()) - 1;
+    new_topic = std::min(std::max(new_topic, 0), num_topics - 1);
+    if (new_topic == old_topic && num_topics > 1) {
+        new_topic = old_topic > 0 ? old_topic - 1 : old_topic + 1;
     }
-    for (int t = 1; t < num_topics; ++t) {
-        if (dart > accum_prob[t - 1] && dart <= accum_prob[t]) {
-            return t;
+
+    return new_topic;
+}
+
+// 为每个F+树采样器分配唯一标识, 从1开始, 0表示上下文中的F+树尚未构建
+static std::atomic<uint64_t> g_ftree_sampler_id(0);
+
+FTreeSampler::FTreeSampler(std::shared_ptr<TopicModel> model)
+    : _model(model), _id(++g_ftree_sampler_id), _exact_sampler(model) {
+    int num_topics = _model->num_topics();
+    _inv_denominator.resize(num_topics);
+    _beta_inv_denominator.resize(num_topics);
+    for (int t = 0; t < num_topics; ++t) {
+        _inv_denominator[t] = _model->inv_topic_denominator(t);
+        _beta_inv_denominator[t] = _model->beta() * _inv_denominator[t];
+    }
+}
+
+void FTreeSampler::sample_doc(LDADoc& doc, InferenceContext& context) const {
+    FTreeState& state = context.ftree_state();
+    sync_tree(doc, state);
+    FTree& tree = state.tree;
+
+    for (size_t i = 0; i < doc.size(); ++i) {
+        int old_topic = doc.token(i).topic;
+        tree.update(old_topic, 0.0);
+        int new_topic = sample_token(doc, doc.token(i), tree, context);
+        doc.set_topic(i, new_topic);
+        if (new_topic != old_topic) {
+            if (state.counts[new_topic] == 0) {
+                state.topics.push_back(new_topic);
+            }
+            update_leaf(state, old_topic, doc.topic_sum(old_topic));
+            update_leaf(state, new_topic, doc.topic_sum(new_topic));
+        } else {
+            tree.update(old_topic, prior_weight(doc.topic_sum(old_topic), old_topic));
+        }
+    }
+}
+
+void FTreeSampler::sync_tree(const LDADoc& doc, FTreeState& state) const {
+    int num_topics = _model->num_topics();
+    if (state.owner != _id || state.tree.size() != num_topics) {
+        // 构建所有主题计数均为0时的F+树
+        state.tree.init(num_topics);
+        for (int t = 0; t < num_topics; ++t) {
+            state.tree.set(t, prior_weight(0, t));
+        }
+        state.tree.build();
+        state.counts.assign(num_topics, 0);
+        state.topics.clear();
+        state.owner = _id;
+    }
+    // 上一次同步以来计数可能非零的主题, 以及当前文档中出现的主题, 覆盖了所有需要更新的叶子
+    for (int t : state.topics) {
+        if (state.counts[t] != static_cast<int>(doc.topic_sum(t))) {
+            update_leaf(state, t, doc.topic_sum(t));
+        }
+    }
+    state.topics.clear();
+    for (size_t i = 0; i < doc.size(); ++i) {
+        int t = doc.token(i).topic;
+        if (state.counts[t] != static_cast<int>(doc.topic_sum(t))) {
+            update_leaf(state, t, doc.topic_sum(t));
+        }
+    }
+    // 重新记录计数非零的主题, 暂时将计数取负以去除重复
+    for (size_t i = 0; i < doc.size(); ++i) {
+        int t = doc.token(i).topic;
+        if (state.counts[t] > 0) {
+            state.topics.push_back(t);
+            state.counts[t] = -state.counts[t];
+        }
+    }
+    for (int t : state.topics) {
+        state.counts[t] = -state.counts[t];
+    }
+}
+
+void FTreeSampler::sample_doc(SLDADoc& doc, InferenceContext& context) const {
+    _exact_sampler.sample_doc(doc, context);
+}
+
+int FTreeSampler::sample_token(LDADoc& doc,
+                               Token& token,
+                               const FTree& tree,
+                               InferenceContext& context) const {
+    int old_topic = token.topic;
+    double alpha = _model->alpha();
+
+    // 词项: 顺序扫描词的非零主题, 跳过当前主题, 同时取得当前主题的词计数
+    WordTopicRow row = _model->word_topic(token.id);
+    std::vector<float>& word_prob = context.prob_buffer(row.size);
+    double word_sum = 0.0;
+    int old_word_count = 0;
+    for (size_t i = 0; i < row.size; ++i) {
+        int t = row.topic(i);
+        if (t == old_topic) {
+            old_word_count = row.count(i);
+            word_prob[i] = 0.0;
+            continue;
+        }
+        word_prob[i] = (doc.topic_sum(t) + alpha) * row.count(i) * _inv_denominator[t];
+        word_sum += word_prob[i];
+    }
+
+    // 当前主题: 与GibbsSampler相同, 扣除当前词自身的计数后精确计算
+    double dt_alpha = doc.topic_sum(old_topic) + alpha;
+    double wt_beta = old_word_count + _model->beta();
+    double t_sum_beta_sum = _model->topic_sum(old_topic) + _model->beta_sum();
+    if (wt_beta > 1) {
+        if (dt_alpha > 1) {
+            dt_alpha -= 1;
+        }
+        wt_beta -= 1;
+        t_sum_beta_sum -= 1;
+    }
+    double old_prob = dt_alpha * wt_beta / t_sum_beta_sum;
+
+    double dart = context.rand() * (old_prob + word_sum + tree.total());
+    if (dart < old_prob) {
+        return old_topic;
+    }
+    dart -= old_prob;
+
+    if (dart < word_sum) {
+        int last = old_topic;
+        for (size_t i = 0; i < row.size; ++i) {
+            if (word_prob[i] <= 0.0) {
+                continue;
+            }
+            last = row.topic(i);
+            dart -= word_prob[i];
+            if (dart < 0) {
+                return last;
+            }
         }
+        return last; // 浮点误差导致未命中时返回最后一个非零项
     }
 
-    return num_topics - 1; // 返回最后一个主题id
+    return tree.sample(dart - word_sum);
 }
 } // namespace familia
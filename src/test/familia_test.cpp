@@ -0,0 +1,643 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "familia/gibbs_kernel.h"
+#include "familia/inference_engine.h"
+#include "familia/model.h"
+#include "familia/result_cache.h"
+#include "familia/thread_pool.h"
+#include "familia/util.h"
+
+using std::string;
+using std::vector;
+using namespace familia; // no lint
+
+// 检查条件是否成立, 不成立时记录失败但继续执行后续检查, 可在多个线程中使用
+#define EXPECT(cond)                                                    \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            LOG(ERROR) << __FILE__ << ":" << __LINE__ << " " << #cond;  \
+            g_failures++;                                               \
+        }                                                               \
+    } while (0)
+
+static std::atomic<int> g_failures(0);
+
+const int NUM_TOPICS = 8;
+const int VOCAB_SIZE = 64;
+
+// 在临时目录中生成一个小规模的LDA模型: 第i个词以主题i % NUM_TOPICS为主, 并带有其他主题的计数
+// 计数均较小, 采样时是否扣除词自身的计数会明显影响结果
+// num_topics大于NUM_TOPICS时, 多出的主题同样随机带有少量计数
+static void write_toy_model(const string& dir,
+                            const string& word_topic_file = "word_topic.model",
+                            int num_topics = NUM_TOPICS) {
+    std::mt19937 rng(2017);
+    std::ofstream vocab((dir + "/vocab_info.txt").c_str());
+    std::ofstream word_topic((dir + "/" + word_topic_file).c_str());
+    for (int i = 0; i < VOCAB_SIZE; ++i) {
+        vocab << "CN\tw" << i << "\t" << i << "\t1\t1\n";
+        word_topic << i << " " << i % NUM_TOPICS << ":" << 4 + rng() % 4;
+        for (int t = 0; t < num_topics; ++t) {
+            if (t != i % NUM_TOPICS && rng() % 2 == 0) {
+                word_topic << " " << t << ":" << 1 + rng() % 2;
+            }
+        }
+        word_topic << "\n";
+    }
+}
+
+// 写入模型配置文件, extra为追加的配置项
+static void write_conf(const string& dir, const string& name, const string& word_topic_file,
+                       const string& extra, float beta = 0.01, int num_topics = NUM_TOPICS,
+                       const string& type = "LDA") {
+    std::ofstream conf((dir + "/" + name).c_str());
+    conf << "type: " << type << "\n"
+         << "num_topics: " << num_topics << "\n"
+         << "alpha: 0.1\n"
+         << "beta: " << beta << "\n"
+         << "word_topic_file: \"" << word_topic_file << "\"\n"
+         << "vocab_file: \"vocab_info.txt\"\n"
+         << extra;
+}
+
+// 生成num_docs篇文档, 每篇文档的词来自两个主题
+static vector<vector<string>> make_docs(int num_docs) {
+    std::mt19937 rng(7);
+    vector<vector<string>> docs(num_docs);
+    for (int d = 0; d < num_docs; ++d) {
+        int size = 5 + rng() % 40;
+        for (int i = 0; i < size; ++i) {
+            int topic = i % 2 == 0 ? d % NUM_TOPICS : (d + 3) % NUM_TOPICS;
+            int word = topic + NUM_TOPICS * (rng() % (VOCAB_SIZE / NUM_TOPICS));
+            docs[d].push_back("w" + std::to_string(word));
+        }
+    }
+    return docs;
+}
+
+static vector<float> dense_dist(const InferenceEngine& engine, const vector<string>& doc) {
+    LDADoc lda_doc;
+    engine.infer(doc, lda_doc);
+    vector<float> dist;
+    lda_doc.dense_topic_dist(dist);
+    return dist;
+}
+
+static uint64_t read_alias_checksum(const string& path) {
+    AliasTableHeader header;
+    std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary);
+    fin.read(reinterpret_cast<char*>(&header), sizeof(header));
+    return fin ? header.model_checksum : 0;
+}
+
+// 文本格式模型转换为二进制格式后重新加载, 两者的参数与推断结果完全一致
+static void test_binary_round_trip(const string& dir) {
+    ModelConfig config;
+    load_prototxt(dir + "/lda.conf", config);
+    TopicModel text_model(dir, config);
+    EXPECT(text_model.save_binary_word_topic(dir + "/word_topic.bin") == 0);
+
+    ModelConfig bin_config;
+    load_prototxt(dir + "/lda_bin.conf", bin_config);
+    TopicModel bin_model(dir, bin_config);
+    EXPECT(bin_model.vocab_size() == text_model.vocab_size());
+    EXPECT(bin_model.num_nonzeros() == text_model.num_nonzeros());
+    EXPECT(bin_model.checksum() == text_model.checksum());
+    for (int t = 0; t < NUM_TOPICS; ++t) {
+        EXPECT(bin_model.topic_sum(t) == text_model.topic_sum(t));
+    }
+    for (size_t w = 0; w < text_model.vocab_size(); ++w) {
+        WordTopicRow a = text_model.word_topic(w);
+        WordTopicRow b = bin_model.word_topic(w);
+        EXPECT(a.size == b.size);
+        for (size_t j = 0; j < a.size && j < b.size; ++j) {
+            EXPECT(a.topic(j) == b.topic(j) && a.count(j) == b.count(j));
+        }
+    }
+
+    EXPECT(bin_model.validate_word_topic());
+
+    // 最后一个计数被改为0或其他正数的文件仍可加载(加载时只校验偏移量)
+    // 但逐项校验会因计数非法或校验和不一致而失败
+    const int32_t bad_counts[] = {0, 1000};
+    for (int32_t bad_count : bad_counts) {
+        {
+            std::ifstream fin((dir + "/word_topic.bin").c_str(), std::ios::in | std::ios::binary);
+            std::ofstream fout((dir + "/word_topic_bad.bin").c_str(),
+                               std::ios::out | std::ios::binary);
+            fout << fin.rdbuf();
+            fout.seekp(-static_cast<int>(sizeof(int32_t)), std::ios::end);
+            fout.write(reinterpret_cast<const char*>(&bad_count), sizeof(bad_count));
+        }
+        ModelConfig bad_config;
+        load_prototxt(dir + "/lda_bad.conf", bad_config);
+        TopicModel bad_model(dir, bad_config);
+        EXPECT(bad_model.checksum() == text_model.checksum());
+        EXPECT(!bad_model.validate_word_topic());
+    }
+
+    InferenceEngine text_engine(dir, "lda.conf", SamplerType::GibbsSampling);
+    InferenceEngine bin_engine(dir, "lda_bin.conf", SamplerType::GibbsSampling);
+    for (const auto& doc : make_docs(20)) {
+        EXPECT(dense_dist(text_engine, doc) == dense_dist(bin_engine, doc));
+    }
+}
+
+// 将文档的词依次划分为长度为1至3的句子
+static vector<vector<vector<string>>> make_sentence_docs(const vector<vector<string>>& docs) {
+    vector<vector<vector<string>>> sentence_docs(docs.size());
+    for (size_t d = 0; d < docs.size(); ++d) {
+        size_t sent_size = 1 + d % 3;
+        for (size_t i = 0; i < docs[d].size(); i += sent_size) {
+            size_t end = std::min(docs[d].size(), i + sent_size);
+            sentence_docs[d].emplace_back(docs[d].begin() + i, docs[d].begin() + end);
+        }
+    }
+    return sentence_docs;
+}
+
+// 按长度排序后从两端交替取出, 使短文本之后紧接长文本, 长文本之后紧接短文本
+template <typename Doc>
+static vector<Doc> alternate_by_size(vector<Doc> docs) {
+    std::sort(docs.begin(), docs.end(), [](const Doc& a, const Doc& b) {
+        return a.size() < b.size();
+    });
+    vector<Doc> result;
+    for (size_t i = 0, j = docs.size(); i < j; ++i) {
+        result.push_back(docs[i]);
+        if (i < --j) {
+            result.push_back(docs[j]);
+        }
+    }
+    return result;
+}
+
+// 两篇文档的稀疏及稠密主题分布完全一致
+static bool same_topic_dist(const LDADoc& a, const LDADoc& b) {
+    vector<Topic> a_sparse;
+    vector<Topic> b_sparse;
+    a.sparse_topic_dist(a_sparse);
+    b.sparse_topic_dist(b_sparse);
+    if (a_sparse.size() != b_sparse.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a_sparse.size(); ++i) {
+        if (a_sparse[i].tid != b_sparse[i].tid || a_sparse[i].prob != b_sparse[i].prob) {
+            return false;
+        }
+    }
+    vector<float> a_dense;
+    vector<float> b_dense;
+    a.dense_topic_dist(a_dense);
+    b.dense_topic_dist(b_dense);
+    return a_dense == b_dense;
+}
+
+// 两个推断结果的稀疏及稠密主题分布完全一致
+static bool same_result(const DocTopicDist& a, const DocTopicDist& b) {
+    if (a.sparse.size() != b.sparse.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.sparse.size(); ++i) {
+        if (a.sparse[i].tid != b.sparse[i].tid || a.sparse[i].prob != b.sparse[i].prob) {
+            return false;
+        }
+    }
+    return a.dense == b.dense;
+}
+
+// 键相同但词id序列不同时按未命中处理并计为冲突, 插入时以新结果替换旧结果
+static void test_result_cache_collision() {
+    ResultCache cache(1 << 20, 4);
+    const uint64_t key = 42;
+    vector<int> ids_a = {1, 2, 3};
+    vector<int> ids_b = {1, 2, 4};
+    DocTopicDist a = {{{0, 0.75}, {3, 0.25}}, {0.7f, 0.1f, 0.1f, 0.1f}};
+    DocTopicDist b = {{{2, 1.0}}, {0.1f, 0.1f, 0.7f, 0.1f}};
+    DocTopicDist result;
+
+    cache.insert(key, ids_a, a);
+    EXPECT(cache.lookup(key, ids_a, result) && same_result(result, a));
+    EXPECT(!cache.lookup(key, ids_b, result));
+    EXPECT(cache.hits() == 1 && cache.misses() == 1 && cache.collisions() == 1);
+
+    cache.insert(key, ids_b, b);
+    EXPECT(cache.num_entries() == 1);
+    EXPECT(cache.lookup(key, ids_b, result) && same_result(result, b));
+    EXPECT(!cache.lookup(key, ids_a, result));
+    EXPECT(cache.hits() == 2 && cache.misses() == 2 && cache.collisions() == 2);
+
+    // 键不同的输入互不影响
+    EXPECT(!cache.lookup(key + 1, ids_b, result));
+    EXPECT(cache.collisions() == 2);
+}
+
+// 开启缓存后首次推断与再次命中缓存的结果均与不使用缓存的推断完全一致
+static void test_result_cache_inference(const string& dir) {
+    vector<vector<string>> docs = make_docs(20);
+    vector<vector<vector<string>>> sentence_docs = make_sentence_docs(docs);
+    InferenceEngine engine(dir, "lda.conf", SamplerType::GibbsSampling);
+    InferenceEngine cached(dir, "lda_cache.conf", SamplerType::GibbsSampling);
+    InferenceEngine slda_engine(dir, "slda.conf", SamplerType::GibbsSampling);
+    InferenceEngine slda_cached(dir, "slda_cache.conf", SamplerType::GibbsSampling);
+    for (int round = 0; round < 2; ++round) {
+        for (size_t d = 0; d < docs.size(); ++d) {
+            DocTopicDist expected;
+            DocTopicDist result;
+            engine.infer_topic_dist(docs[d], expected);
+            cached.infer_topic_dist(docs[d], result);
+            EXPECT(same_result(result, expected));
+
+            slda_engine.infer_topic_dist(sentence_docs[d], expected);
+            slda_cached.infer_topic_dist(sentence_docs[d], result);
+            EXPECT(same_result(result, expected));
+        }
+    }
+    EXPECT(engine.result_cache() == nullptr);
+    EXPECT(cached.result_cache()->hits() == docs.size());
+    EXPECT(cached.result_cache()->misses() == docs.size());
+    EXPECT(slda_cached.result_cache()->hits() == docs.size());
+    EXPECT(slda_cached.result_cache()->misses() == docs.size());
+
+    // 词相同但句子划分不同的输入不会命中缓存
+    vector<vector<string>> merged(1);
+    for (const auto& sent : sentence_docs[1]) {
+        merged[0].insert(merged[0].end(), sent.begin(), sent.end());
+    }
+    DocTopicDist expected;
+    DocTopicDist result;
+    slda_engine.infer_topic_dist(merged, expected);
+    slda_cached.infer_topic_dist(merged, result);
+    EXPECT(same_result(result, expected));
+    EXPECT(slda_cached.result_cache()->hits() == docs.size());
+}
+
+// 对象池中复用的文档依次推断长短交替的文档, 结果与新建的文档完全一致
+// 模型有256个主题, 少于32个词(句子)的文档只维护出现过的主题, 复用时只清除这些主题
+static void test_pooled_doc_reuse(const string& dir) {
+    const SamplerType types[] = {SamplerType::GibbsSampling,
+                                 SamplerType::MetropolisHastings,
+                                 SamplerType::SparseGibbsSampling,
+                                 SamplerType::FTreeSampling};
+    vector<vector<string>> docs = alternate_by_size(make_docs(40));
+    vector<vector<vector<string>>> sentence_docs = alternate_by_size(make_sentence_docs(docs));
+    for (SamplerType type : types) {
+        InferenceEngine engine(dir, "lda_wide.conf", type);
+        for (const auto& doc : docs) {
+            auto pooled = engine.lda_doc_pool().acquire();
+            engine.infer(doc, *pooled);
+            LDADoc fresh;
+            engine.infer(doc, fresh);
+            EXPECT(same_topic_dist(*pooled, fresh));
+        }
+        EXPECT(engine.lda_doc_pool().num_idle() == 1);
+
+        InferenceEngine slda_engine(dir, "slda_wide.conf", type);
+        for (const auto& doc : sentence_docs) {
+            auto pooled = slda_engine.slda_doc_pool().acquire();
+            slda_engine.infer(doc, *pooled);
+            SLDADoc fresh;
+            slda_engine.infer(doc, fresh);
+            EXPECT(same_topic_dist(*pooled, fresh));
+        }
+        EXPECT(slda_engine.slda_doc_pool().num_idle() == 1);
+    }
+}
+
+// 预先计算的phi行与由计数计算的概率逐项相同, 开启后推断结果不变
+// 交错推断短文本的批量结果与逐篇调用infer完全一致, 包括收敛提前结束及长短文本混合的情况
+static void test_batch_interleave(const string& dir) {
+    const SamplerType types[] = {SamplerType::GibbsSampling,
+                                 SamplerType::MetropolisHastings,
+                                 SamplerType::SparseGibbsSampling,
+                                 SamplerType::FTreeSampling};
+    const char* confs[] = {"lda_wide_il.conf", "lda_wide_il_conv.conf"};
+    vector<vector<string>> docs = make_docs(43);
+    docs.push_back({});
+    docs.push_back({"unknown"});
+    for (SamplerType type : types) {
+        for (const char* conf : confs) {
+            InferenceEngine engine(dir, conf, type);
+            vector<LDADoc> batch_docs;
+            engine.infer_batch(docs, batch_docs);
+            EXPECT(batch_docs.size() == docs.size());
+            for (size_t i = 0; i < docs.size(); ++i) {
+                LDADoc doc;
+                engine.infer(docs[i], doc);
+                EXPECT(same_topic_dist(batch_docs[i], doc));
+                EXPECT(batch_docs[i].num_sweeps() == doc.num_sweeps());
+            }
+        }
+    }
+}
+
+static void test_phi_rows(const string& dir) {
+    ModelConfig config;
+    load_prototxt(dir + "/lda.conf", config);
+    TopicModel model(dir, config);
+    ModelConfig phi_config;
+    load_prototxt(dir + "/lda_phi.conf", phi_config);
+    TopicModel phi_model(dir, phi_config);
+    for (size_t w = 0; w < model.vocab_size(); ++w) {
+        EXPECT(model.phi_row(w) == nullptr);
+        const float* phi = phi_model.phi_row(w);
+        EXPECT(phi != nullptr);
+        for (int t = 0; t < NUM_TOPICS && phi != nullptr; ++t) {
+            float prob = model.word_topic_prob(w, t);
+            EXPECT(memcmp(&phi[t], &prob, sizeof(prob)) == 0);
+            EXPECT(phi_model.word_topic_prob(w, t) == prob);
+        }
+    }
+
+    InferenceEngine engine(dir, "lda.conf", SamplerType::MetropolisHastings);
+    InferenceEngine phi_engine(dir, "lda_phi.conf", SamplerType::MetropolisHastings);
+    for (const auto& doc : make_docs(20)) {
+        EXPECT(dense_dist(engine, doc) == dense_dist(phi_engine, doc));
+    }
+}
+
+// alias table缓存文件与模型校验和不一致时重新构建并覆盖, 加载与重新构建的结果一致
+static void test_alias_sidecar_rebuild(const string& dir) {
+    string alias_path = dir + "/word_topic.model.alias";
+    unlink(alias_path.c_str());
+    vector<vector<string>> docs = make_docs(20);
+    vector<vector<float>> built;
+    {
+        InferenceEngine engine(dir, "lda.conf", SamplerType::MetropolisHastings);
+        for (const auto& doc : docs) {
+            built.push_back(dense_dist(engine, doc));
+        }
+    }
+    uint64_t checksum = read_alias_checksum(alias_path);
+    EXPECT(access(alias_path.c_str(), R_OK) == 0);
+    EXPECT(checksum != 0);
+
+    // 篡改文件头中的模型校验和
+    {
+        std::fstream file(alias_path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+        AliasTableHeader header;
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        header.model_checksum ^= 1;
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+    EXPECT(read_alias_checksum(alias_path) != checksum);
+    {
+        InferenceEngine engine(dir, "lda.conf", SamplerType::MetropolisHastings);
+        EXPECT(read_alias_checksum(alias_path) == checksum);
+        for (size_t i = 0; i < docs.size(); ++i) {
+            EXPECT(dense_dist(engine, docs[i]) == built[i]);
+        }
+    }
+    // 校验和一致时直接加载
+    {
+        InferenceEngine engine(dir, "lda.conf", SamplerType::MetropolisHastings);
+        for (size_t i = 0; i < docs.size(); ++i) {
+            EXPECT(dense_dist(engine, docs[i]) == built[i]);
+        }
+    }
+    // 超参数变化后模型校验和随之变化, 缓存文件同样重新构建
+    {
+        InferenceEngine engine(dir, "lda_beta.conf", SamplerType::MetropolisHastings);
+        uint64_t new_checksum = read_alias_checksum(dir + "/word_topic.model.beta.alias");
+        EXPECT(new_checksum != 0 && new_checksum != checksum);
+    }
+}
+
+// 批量推断的结果与线程数无关, 且与逐篇推断完全一致
+static void test_batch_threads(const string& dir) {
+    vector<vector<string>> docs = make_docs(100);
+    const SamplerType types[] = {SamplerType::GibbsSampling,
+                                 SamplerType::MetropolisHastings,
+                                 SamplerType::SparseGibbsSampling,
+                                 SamplerType::FTreeSampling};
+    for (SamplerType type : types) {
+        InferenceEngine single(dir, "lda.conf", type);
+        InferenceEngine multi(dir, "lda_t4.conf", type);
+        vector<LDADoc> single_docs;
+        vector<LDADoc> multi_docs;
+        single.infer_batch(docs, single_docs);
+        multi.infer_batch(docs, multi_docs);
+        for (size_t i = 0; i < docs.size(); ++i) {
+            vector<float> a;
+            vector<float> b;
+            single_docs[i].dense_topic_dist(a);
+            multi_docs[i].dense_topic_dist(b);
+            EXPECT(a == b);
+            EXPECT(a == dense_dist(single, docs[i]));
+        }
+    }
+}
+
+// 当前CPU支持的各个吉布斯采样内核逐元素的结果完全一致, 且与gibbs_topic_prob一致
+// 主题数覆盖向量宽度的整数倍及带有尾部元素的情况
+static void test_gibbs_kernels() {
+    const vector<GibbsKernel>& kernels = supported_gibbs_kernels();
+    EXPECT(string(kernels.front().name) == gibbs_kernel_name());
+    EXPECT(string(kernels.back().name) == "scalar");
+    LOG(INFO) << "Compare " << kernels.size() << " Gibbs sampling kernel(s)";
+
+    std::mt19937 rng(11);
+    const int sizes[] = {1, 3, 4, 7, 8, 13, 100, 1001};
+    for (int num_topics : sizes) {
+        vector<int32_t> doc_counts(num_topics);
+        vector<int32_t> word_counts(num_topics);
+        vector<float> inv_denominators(num_topics);
+        vector<float> log_denominators(num_topics);
+        vector<float> log_prob(num_topics);
+        for (int t = 0; t < num_topics; ++t) {
+            doc_counts[t] = rng() % 50;
+            word_counts[t] = rng() % 2 == 0 ? rng() % 10 : rng() % 1000000;
+            float denominator = 1000.0f + rng() % 10000000;
+            inv_denominators[t] = 1.0f / denominator;
+            log_denominators[t] = std::log(denominator);
+            log_prob[t] = -static_cast<float>(rng() % 100000) / 1000.0f;
+        }
+
+        vector<vector<float>> token_probs;
+        vector<vector<float>> log_probs;
+        vector<vector<float>> exp_probs;
+        for (const GibbsKernel& kernel : kernels) {
+            vector<float> token_prob(num_topics);
+            kernel.token_prob(doc_counts.data(), word_counts.data(), inv_denominators.data(),
+                              0.1f, 0.01f, num_topics, token_prob.data());
+            token_probs.push_back(token_prob);
+            vector<float> sentence_log_prob(num_topics);
+            kernel.log_prob(log_denominators.data(), 37.0f, 5.5f, num_topics,
+                            sentence_log_prob.data());
+            log_probs.push_back(sentence_log_prob);
+            vector<float> exp_prob = log_prob;
+            kernel.exp_prob(-1.5f, num_topics, exp_prob.data());
+            exp_probs.push_back(exp_prob);
+        }
+        size_t bytes = sizeof(float) * num_topics;
+        for (size_t k = 1; k < kernels.size(); ++k) {
+            EXPECT(memcmp(token_probs[k].data(), token_probs[0].data(), bytes) == 0);
+            EXPECT(memcmp(log_probs[k].data(), log_probs[0].data(), bytes) == 0);
+            EXPECT(memcmp(exp_probs[k].data(), exp_probs[0].data(), bytes) == 0);
+        }
+        for (int t = 0; t < num_topics; ++t) {
+            float prob = gibbs_topic_prob(doc_counts[t], word_counts[t], inv_denominators[t],
+                                          0.1f, 0.01f);
+            EXPECT(memcmp(&prob, &token_probs[0][t], sizeof(prob)) == 0);
+        }
+    }
+}
+
+// 调用parallel_for, 检查[0, n)内每个下标恰好执行一次, 下标0由调用线程执行,
+// 且返回时本次调用的全部下标均已完成
+static void check_parallel_for(ThreadPool& pool, size_t n, int depth) {
+    std::thread::id caller = std::this_thread::get_id();
+    std::unique_ptr<std::atomic<int>[]> counts(new std::atomic<int>[n]);
+    for (size_t i = 0; i < n; ++i) {
+        counts[i] = 0;
+    }
+    std::atomic<bool> caller_runs_first(false);
+    std::atomic<bool> worker_id_valid(true);
+    pool.parallel_for(n, [&](size_t index, int worker_id) {
+        if (index == 0) {
+            caller_runs_first = std::this_thread::get_id() == caller && worker_id == -1;
+        }
+        if (worker_id < -1 || worker_id >= pool.num_threads() - 1) {
+            worker_id_valid = false;
+        }
+        // 任务内部再次调用parallel_for
+        if (depth > 0) {
+            check_parallel_for(pool, 8, depth - 1);
+        }
+        counts[index]++;
+    });
+    EXPECT(caller_runs_first);
+    EXPECT(worker_id_valid);
+    for (size_t i = 0; i < n; ++i) {
+        EXPECT(counts[i] == 1);
+    }
+}
+
+// 线程池的批次语义: 嵌套调用及多个线程同时调用时均不会死锁, 且各调用只等待自身的下标
+static void test_thread_pool() {
+    ThreadPool pool(4);
+    EXPECT(pool.num_threads() == 4);
+    for (int i = 0; i < 100; ++i) {
+        check_parallel_for(pool, 1 + i % 20, 0);
+    }
+    for (int i = 0; i < 20; ++i) {
+        check_parallel_for(pool, 6, 2);
+    }
+
+    std::vector<std::thread> callers;
+    for (int c = 0; c < 4; ++c) {
+        callers.emplace_back([&pool, c] {
+            for (int i = 0; i < 50; ++i) {
+                check_parallel_for(pool, 1 + (i + c) % 30, i % 5 == 0 ? 1 : 0);
+            }
+        });
+    }
+    for (auto& thread : callers) {
+        thread.join();
+    }
+
+    // 单线程的线程池没有工作线程, 全部下标由调用线程执行
+    ThreadPool single(1);
+    EXPECT(single.num_threads() == 1);
+    check_parallel_for(single, 10, 1);
+}
+
+// SparseGibbs及F+树采样器与Gibbs采样器采样同一分布, 长链推断得到的主题分布应接近
+// Gibbs使用不同的seed_salt, 避免相同的随机数序列使结果人为地接近
+static void test_sampler_agreement(const string& dir) {
+    vector<vector<string>> docs = make_docs(16);
+    InferenceEngine gibbs(dir, "lda_long_salt.conf", SamplerType::GibbsSampling);
+    InferenceEngine sparse(dir, "lda_long.conf", SamplerType::SparseGibbsSampling);
+    InferenceEngine ftree(dir, "lda_long.conf", SamplerType::FTreeSampling);
+    double sparse_l1 = 0.0;
+    double ftree_l1 = 0.0;
+    for (size_t d = 0; d < docs.size(); ++d) {
+        vector<float> expected = dense_dist(gibbs, docs[d]);
+        vector<float> sparse_dist = dense_dist(sparse, docs[d]);
+        vector<float> ftree_dist = dense_dist(ftree, docs[d]);
+        for (int t = 0; t < NUM_TOPICS; ++t) {
+            sparse_l1 += std::fabs(sparse_dist[t] - expected[t]);
+            ftree_l1 += std::fabs(ftree_dist[t] - expected[t]);
+        }
+        // 文档的词来自两个主题, 这两个主题应占据大部分概率
+        int t0 = d % NUM_TOPICS;
+        int t1 = (d + 3) % NUM_TOPICS;
+        EXPECT(expected[t0] + expected[t1] > 0.75);
+    }
+    sparse_l1 /= docs.size();
+    ftree_l1 /= docs.size();
+    LOG(INFO) << "Mean L1 distance to Gibbs: sparse = " << sparse_l1 << " ftree = " << ftree_l1;
+    EXPECT(sparse_l1 < 0.01);
+    EXPECT(ftree_l1 < 0.01);
+}
+
+// 在临时目录中生成模型并依次运行各项测试, 全部通过时返回0
+int main() {
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    char dir_template[] = "/tmp/familia_test.XXXXXX";
+    CHECK(mkdtemp(dir_template) != nullptr) << "Failed to create temporary directory!";
+    string dir = dir_template;
+    write_toy_model(dir);
+    write_toy_model(dir, "word_topic_wide.model", 256);
+    write_conf(dir, "lda.conf", "word_topic.model", "infer_threads: 1\n");
+    write_conf(dir, "lda_t4.conf", "word_topic.model", "infer_threads: 4\n");
+    write_conf(dir, "lda_bin.conf", "word_topic.bin", "");
+    write_conf(dir, "lda_bad.conf", "word_topic_bad.bin", "");
+    write_conf(dir, "lda_cache.conf", "word_topic.model", "result_cache_bytes: 1048576\n");
+    write_conf(dir, "slda.conf", "word_topic.model", "", 0.01, NUM_TOPICS, "SLDA");
+    write_conf(dir, "slda_cache.conf", "word_topic.model", "result_cache_bytes: 1048576\n",
+               0.01, NUM_TOPICS, "SLDA");
+    write_conf(dir, "lda_wide.conf", "word_topic_wide.model", "", 0.01, 256);
+    write_conf(dir, "slda_wide.conf", "word_topic_wide.model", "", 0.01, 256, "SLDA");
+    write_conf(dir, "lda_wide_il.conf", "word_topic_wide.model",
+               "infer_threads: 2\nbatch_interleave_docs: 4\n", 0.01, 256);
+    write_conf(dir, "lda_wide_il_conv.conf", "word_topic_wide.model",
+               "infer_threads: 2\nbatch_interleave_docs: 4\nconvergence_tolerance: 0.05\n",
+               0.01, 256);
+    write_conf(dir, "lda_phi.conf", "word_topic.model", "phi_table_memory_mb: 1\n");
+    write_conf(dir, "lda_long.conf", "word_topic.model", "burn_in_iter: 50\nmax_iter: 10000\n");
+    write_conf(dir, "lda_long_salt.conf", "word_topic.model",
+               "burn_in_iter: 50\nmax_iter: 10000\nseed_salt: 1\n");
+    write_conf(dir, "lda_beta.conf", "word_topic.model",
+               "alias_table_file: \"word_topic.model.beta.alias\"\n", 0.02);
+
+    test_binary_round_trip(dir);
+    test_alias_sidecar_rebuild(dir);
+    test_phi_rows(dir);
+    test_gibbs_kernels();
+    test_thread_pool();
+    test_pooled_doc_reuse(dir);
+    test_result_cache_collision();
+    test_result_cache_inference(dir);
+    test_batch_threads(dir);
+    test_batch_interleave(dir);
+    test_sampler_agreement(dir);
+
+    string command = "rm -rf " + dir;
+    if (system(command.c_str()) != 0) {
+        LOG(WARNING) << "Failed to remove " << dir;
+    }
+    if (g_failures > 0) {
+        LOG(ERROR) << g_failures << " check(s) failed!";
+        return 1;
+    }
+    LOG(INFO) << "All tests passed!";
+    return 0;
+}
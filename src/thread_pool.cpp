@@ -0,0 +1,99 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "familia/thread_pool.h"
+
+#include <algorithm>
+
+namespace familia {
+
+ThreadPool::ThreadPool(int num_threads) : _stop(false) {
+    if (num_threads <= 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // 调用线程也参与计算, 因此只需启动num_threads - 1个工作线程
+    for (int i = 0; i < num_threads - 1; ++i) {
+        _threads.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _work_cv.notify_all();
+    for (auto& thread : _threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t, int)>& func) {
+    if (n == 0) {
+        return;
+    }
+    Batch batch;
+    batch.func = &func;
+    batch.size = n;
+    // 下标0留给调用线程, 工作线程从下标1开始领取
+    batch.next = 1;
+    batch.workers = 0;
+    if (n > 1 && !_threads.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _batches.push_back(&batch);
+        }
+        _work_cv.notify_all();
+    }
+    func(0, -1);
+    run_batch(batch, -1);
+
+    // 所有下标均已被领取, 等待仍在执行本批次任务的工作线程完成, 避免其访问已失效的批次
+    remove_batch(&batch);
+    std::unique_lock<std::mutex> lock(batch.mutex);
+    batch.done_cv.wait(lock, [&batch] { return batch.workers == 0; });
+}
+
+void ThreadPool::worker_loop(int worker_id) {
+    while (true) {
+        Batch* batch = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _work_cv.wait(lock, [this] { return _stop || !_batches.empty(); });
+            if (_stop) {
+                return;
+            }
+            // 多个批次同时存在时轮流服务, 避免某个调用方长时间得不到工作线程
+            batch = _batches.front();
+            _batches.pop_front();
+            _batches.push_back(batch);
+            // 在_mutex保护下登记, 保证调用方移除批次后不会再有新的工作线程加入
+            ++batch->workers;
+        }
+
+        run_batch(*batch, worker_id);
+        remove_batch(batch);
+
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        if (--batch->workers == 0) {
+            batch->done_cv.notify_all();
+        }
+    }
+}
+
+void ThreadPool::run_batch(Batch& batch, int worker_id) {
+    size_t index = 0;
+    while ((index = batch.next.fetch_add(1)) < batch.size) {
+        (*batch.func)(index, worker_id);
+    }
+}
+
+void ThreadPool::remove_batch(Batch* batch) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = std::find(_batches.begin(), _batches.end(), batch);
+    if (it != _batches.end()) {
+        _batches.erase(it);
+    }
+}
+} // namespace familia
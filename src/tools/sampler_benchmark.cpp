@@ -0,0 +1,234 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "familia/inference_engine.h"
+#include "familia/tokenizer.h"
+#include "familia/util.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <gflags/gflags.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::vector;
+using namespace familia; // no lint
+
+DEFINE_string(model_dir, "./", "model directory");
+DEFINE_string(conf_file, "lda.conf", "model configuration file");
+DEFINE_string(input_file, "", "input documents, one document per line");
+DEFINE_string(samplers, "mh,gibbs,sparse,ftree", "comma separated samplers to benchmark");
+DEFINE_int32(rounds, 1, "number of passes over the input documents");
+
+// 基于perf_event_open统计当前线程用户态的末级缓存(LLC)读缺失次数
+// 系统不支持或没有权限时available()返回false
+class LlcMissCounter {
+public:
+    LlcMissCounter() : _fd(-1) {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_LL
+                      | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~LlcMissCounter() {
+#ifdef __linux__
+        if (_fd >= 0) {
+            close(_fd);
+        }
+#endif
+    }
+
+    bool available() const {
+        return _fd >= 0;
+    }
+
+    void start() {
+#ifdef __linux__
+        if (_fd >= 0) {
+            ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // 停止计数并返回start之后的缺失次数
+    uint64_t stop() {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (_fd >= 0) {
+            ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(_fd, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+
+    // no copying allowed
+    LlcMissCounter(const LlcMissCounter&) = delete;
+    LlcMissCounter& operator=(const LlcMissCounter&) = delete;
+
+private:
+    int _fd;
+};
+
+// 采样器名称与类型的对应关系
+static bool parse_sampler(const string& name, SamplerType& type) {
+    if (name == "gibbs") {
+        type = SamplerType::GibbsSampling;
+    } else if (name == "mh") {
+        type = SamplerType::MetropolisHastings;
+    } else if (name == "sparse") {
+        type = SamplerType::SparseGibbsSampling;
+    } else if (name == "ftree") {
+        type = SamplerType::FTreeSampling;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// 为了简化句子边界问题，以5-gram作为一个句子, 与inference_demo保持一致
+static void split_sentences(const vector<string>& input, vector<vector<string>>& sentences) {
+    sentences.clear();
+    for (size_t i = 0; i < input.size(); i += 5) {
+        sentences.emplace_back(input.begin() + i, input.begin() + std::min(input.size(), i + 5));
+    }
+}
+
+// 对所有文档进行推断, 返回每篇文档的稠密主题分布、采样总轮数、LLC缺失次数及耗时(毫秒)
+static double run_sampler(const InferenceEngine& engine,
+                          const vector<vector<string>>& docs,
+                          vector<vector<float>>& topic_dists,
+                          size_t& num_sweeps,
+                          LlcMissCounter& counter,
+                          uint64_t& llc_misses) {
+    topic_dists.resize(docs.size());
+    num_sweeps = 0;
+    vector<vector<string>> sentences;
+    counter.start();
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < FLAGS_rounds; ++round) {
+        for (size_t i = 0; i < docs.size(); ++i) {
+            if (engine.model_type() == ModelType::LDA) {
+                LDADoc doc;
+                engine.infer(docs[i], doc);
+                doc.dense_topic_dist(topic_dists[i]);
+                num_sweeps += doc.num_sweeps();
+            } else {
+                split_sentences(docs[i], sentences);
+                SLDADoc doc;
+                engine.infer(sentences, doc);
+                doc.dense_topic_dist(topic_dists[i]);
+                num_sweeps += doc.num_sweeps();
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    llc_misses = counter.stop();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// 在同一批文档上对比各采样器的推断速度、平均采样轮数、每次推断中平均每个词的LLC缺失次数,
+// 以及与Metropolis-Hastings采样结果的平均L1距离
+// 预取距离、采样顺序等选项通过conf_file配置, 可使用不同的配置文件分别运行进行对比
+int main(int argc, char* argv[]) {
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+    google::SetVersionString("1.0.0.0");
+    string usage = string("Usage: ./sampler_benchmark --model_dir=\"PATH/TO/MODEL\" ") +
+                   string("--conf_file=\"lda.conf\" --input_file=\"docs.txt\" ") +
+                   string("--samplers=\"mh,gibbs,sparse,ftree\"");
+    google::SetUsageMessage(usage);
+    google::ParseCommandLineFlags(&argc, &argv, true);
+
+    std::ifstream fin(FLAGS_input_file.c_str(), std::ios::in);
+    if (!fin) {
+        LOG(ERROR) << "Failed to open input file: " << FLAGS_input_file;
+        return -1;
+    }
+    Tokenizer* tokenizer = new SimpleTokenizer(FLAGS_model_dir + "/vocab_info.txt");
+    vector<vector<string>> docs;
+    size_t num_tokens = 0;
+    string line;
+    while (getline(fin, line)) {
+        vector<string> input;
+        tokenizer->tokenize(line, input);
+        num_tokens += input.size();
+        docs.push_back(input);
+    }
+    delete tokenizer;
+    LOG(INFO) << "Load " << docs.size() << " documents, #tokens = " << num_tokens;
+
+    vector<string> names;
+    split(names, FLAGS_samplers, ',');
+    vector<vector<float>> baseline;
+    LlcMissCounter counter;
+    if (!counter.available()) {
+        LOG(WARNING) << "LLC miss counter is not available, check perf_event_paranoid.";
+    }
+    printf("%-8s %12s %14s %12s %16s %14s\n", "sampler", "time(ms)", "tokens/s", "avg sweeps",
+           "LLC miss/token", "L1 vs mh");
+    for (const auto& name : names) {
+        SamplerType type;
+        if (!parse_sampler(name, type)) {
+            LOG(ERROR) << "Unknown sampler: " << name;
+            return -1;
+        }
+        InferenceEngine engine(FLAGS_model_dir, FLAGS_conf_file, type);
+        vector<vector<float>> topic_dists;
+        size_t num_sweeps = 0;
+        uint64_t llc_misses = 0;
+        double elapsed = run_sampler(engine, docs, topic_dists, num_sweeps, counter, llc_misses);
+        if (type == SamplerType::MetropolisHastings) {
+            baseline = topic_dists;
+        }
+        double l1 = 0.0;
+        if (!baseline.empty()) {
+            for (size_t i = 0; i < docs.size(); ++i) {
+                for (size_t t = 0; t < topic_dists[i].size(); ++t) {
+                    l1 += std::fabs(topic_dists[i][t] - baseline[i][t]);
+                }
+            }
+            l1 /= std::max<size_t>(docs.size(), 1);
+        }
+        double throughput = num_tokens * FLAGS_rounds / (elapsed / 1000.0);
+        double avg_sweeps = num_sweeps * 1.0 / std::max<size_t>(docs.size() * FLAGS_rounds, 1);
+        // 缺失总数除以推断的词数(num_tokens * rounds), 即每次推断中平均每个词的缺失次数
+        // 包含该次推断的全部采样轮, 除以avg sweeps可得每轮每个词的缺失次数
+        string misses = "-";
+        if (counter.available()) {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.3f",
+                     llc_misses * 1.0 / std::max<size_t>(num_tokens * FLAGS_rounds, 1));
+            misses = buffer;
+        }
+        if (baseline.empty()) {
+            printf("%-8s %12.1f %14.0f %12.1f %16s %14s\n", name.c_str(), elapsed, throughput,
+                   avg_sweeps, misses.c_str(), "-");
+        } else {
+            printf("%-8s %12.1f %14.0f %12.1f %16s %14.4f\n", name.c_str(), elapsed, throughput,
+                   avg_sweeps, misses.c_str(), l1);
+        }
+    }
+
+    return 0;
+}
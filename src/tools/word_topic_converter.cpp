@@ -0,0 +1,44 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "familia/model.h"
+#include "familia/util.h"
+
+#include <gflags/gflags.h>
+
+using std::string;
+using namespace familia; // no lint
+
+DEFINE_string(model_dir, "./", "model directory");
+DEFINE_string(conf_file, "lda.conf", "model configuration file");
+DEFINE_string(output_file, "word_topic.bin", "output binary word topic file");
+
+// 将文本格式的word topic模型转换为可直接mmap加载的二进制格式
+// 转换完成后重新加载输出文件并逐项校验, 之后将模型配置中的word_topic_file指向输出文件即可
+int main(int argc, char* argv[]) {
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+    google::SetVersionString("1.0.0.0");
+    string usage = string("Usage: ./word_topic_converter --model_dir=\"PATH/TO/MODEL\" ") +
+                   string("--conf_file=\"lda.conf\" --output_file=\"word_topic.bin\"");
+    google::SetUsageMessage(usage);
+    google::ParseCommandLineFlags(&argc, &argv, true);
+
+    ModelConfig config;
+    load_prototxt(FLAGS_model_dir + "/" + FLAGS_conf_file, config);
+    TopicModel model(FLAGS_model_dir, config);
+
+    string output_path = FLAGS_model_dir + "/" + FLAGS_output_file;
+    if (model.save_binary_word_topic(output_path) != 0) {
+        LOG(ERROR) << "Failed to convert word topic model!";
+        return -1;
+    }
+
+    // 在线加载时只校验偏移量, 主题id及计数的逐项校验在转换时完成
+    config.set_word_topic_file(FLAGS_output_file);
+    config.set_validate_word_topic(true);
+    TopicModel binary_model(FLAGS_model_dir, config);
+    LOG(INFO) << "Validate " << output_path << " successfully!";
+
+    return 0;
+}
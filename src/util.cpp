@@ -4,6 +4,11 @@
 
 #include "familia/util.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace familia {
 
 void split(std::vector<std::string>& result, const std::string& text, char separator) {
@@ -20,4 +25,47 @@ void split(std::vector<std::string>& result, const std::string& text, char separ
     // NOTE: 如果输入没有分割字符，则返回原输入
     result.push_back(text.substr(start));
 }
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+int MappedFile::open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG(ERROR) << "Failed to open file: " << path;
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        LOG(ERROR) << "Failed to stat file: " << path;
+        ::close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        // mmap不支持长度为0的映射, 空文件视为空的映射, data()返回nullptr
+        ::close(fd);
+        return 0;
+    }
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // 映射建立后即可关闭文件描述符
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        LOG(ERROR) << "Failed to mmap file: " << path;
+        return -1;
+    }
+    _data = static_cast<const char*>(addr);
+    _size = st.st_size;
+
+    return 0;
+}
+
+void MappedFile::close() {
+    if (_data != nullptr) {
+        munmap(const_cast<char*>(_data), _size);
+        _data = nullptr;
+        _size = 0;
+    }
+}
 } // namespace familia
@@ -5,7 +5,8 @@
 #include "familia/vocab.h"
 #include "familia/util.h"
 
-#include <fstream>
+#include <algorithm>
+#include <cstring>
 #include <vector>
 
 namespace familia {
@@ -21,24 +22,41 @@ size_t Vocab::size() const {
 
 void Vocab::load(const std::string& vocab_file) {
     _term2id.clear();
-    std::ifstream fin(vocab_file, std::ios::in);
-    CHECK(fin) << "Failed to open vocab file!";
-
-    std::string line;
-    std::vector<std::string> term_id;
-    while (getline(fin, line)) {
-        term_id.clear();
-        split(term_id, line, '\t');
-        CHECK_EQ(term_id.size(), 5) << "Vocabulary file [" << vocab_file << "] format error!";
-        std::string term = term_id[1];
-        int id = std::stoi(term_id[2]);
-        if (_term2id.find(term) != _term2id.end()) {
-            LOG(ERROR) << "Duplicate word [" << term << "] in vocab file";
-            continue;
+    MappedFile file;
+    CHECK_EQ(file.open(vocab_file), 0) << "Failed to open vocab file!";
+
+    const char* ptr = file.data();
+    const char* end = ptr + file.size();
+    _term2id.reserve(std::count(ptr, end, '\n') + 1);
+    // 每行包含5个以'\t'分隔的字段, 其中第2个字段为明文, 第3个字段为词id
+    constexpr int NUM_FIELDS = 5;
+    const char* fields[NUM_FIELDS + 1];
+    while (ptr < end) {
+        const char* line_end = static_cast<const char*>(memchr(ptr, '\n', end - ptr));
+        if (line_end == nullptr) {
+            line_end = end;
         }
-        _term2id[term] = id;
+        int num_fields = 0;
+        fields[num_fields++] = ptr;
+        for (const char* pos = ptr; num_fields <= NUM_FIELDS; ++pos) {
+            pos = static_cast<const char*>(memchr(pos, '\t', line_end - pos));
+            if (pos == nullptr) {
+                break;
+            }
+            fields[num_fields++] = pos + 1;
+        }
+        CHECK_EQ(num_fields, NUM_FIELDS) << "Vocabulary file [" << vocab_file << "] format error!";
+        std::string term(fields[1], fields[2] - 1);
+        const char* id_ptr = fields[2];
+        int id = 0;
+        CHECK(parse_uint(id_ptr, fields[3] - 1, id))
+            << "Vocabulary file [" << vocab_file << "] format error!";
+        if (!_term2id.emplace(std::move(term), id).second) {
+            LOG(ERROR) << "Duplicate word [" << std::string(fields[1], fields[2] - 1)
+                       << "] in vocab file";
+        }
+        ptr = line_end + 1;
     }
-    fin.close();
 
     LOG(INFO) << "Load vocabulary success! #vocabulary size = " << size();
 }
@@ -3,64 +3,59 @@
 // found in the LICENSE file.
 
 #include "familia/vose_alias.h"
-#include "familia/util.h"
-
-#include <queue>
 
 namespace familia {
 
-void VoseAlias::initialize(const std::vector<double>& distribution) {
+template <typename TopicId>
+void build_alias_entries(const std::vector<double>& distribution,
+                         const int32_t* topics,
+                         BasicAliasEntry<TopicId>* entries) {
     int size = distribution.size();
-    _prob.resize(size);
-    _alias.resize(size);
     std::vector<double> p(size, 0.0);
     double sum = 0;
     for (int i = 0; i < size; ++i) {
         sum += distribution[i];
     }
+    std::vector<int> large;
+    std::vector<int> small;
     for (int i = 0; i < size; ++i) {
         p[i] = distribution[i] / sum * size; // scale up probability
-    }
-    
-    std::queue<double> large;
-    std::queue<double> small;
-    for (int i = 0; i < size; ++i) {
-        if (p[i] < 1.0)  {
-            small.push(i);
+        entries[i].topic = static_cast<TopicId>(topics != nullptr ? topics[i] : i);
+        if (p[i] < 1.0) {
+            small.push_back(i);
         } else {
-            large.push(i);
+            large.push_back(i);
         }
     }
     while (!small.empty() && !large.empty()) {
-        int l = small.front();
-        int g = large.front();
-        small.pop();
-        large.pop();
-        _prob[l] = p[l];
-        _alias[l] = g;
+        int l = small.back();
+        int g = large.back();
+        small.pop_back();
+        large.pop_back();
+        entries[l].prob = p[l];
+        entries[l].alias_topic = entries[g].topic;
         p[g] = p[g] + p[l] - 1; // a more numerically stable option
         if (p[g] < 1.0) {
-            small.push(g);
+            small.push_back(g);
         } else {
-            large.push(g);
+            large.push_back(g);
         }
     }
-    while (!large.empty()) {
-        int g = large.front();
-        large.pop();
-        _prob[g] = 1.0;
+    // 剩余的桶概率均为1, alias不会被使用
+    for (int g : large) {
+        entries[g].prob = 1.0;
+        entries[g].alias_topic = entries[g].topic;
     }
-    while (!small.empty()) {
-        int l = small.front();
-        small.pop();
-        _prob[l] = 1.0;
+    for (int l : small) {
+        entries[l].prob = 1.0;
+        entries[l].alias_topic = entries[l].topic;
     }
 }
 
-int VoseAlias::generate() const {
-    int dart1 = rand_k(size());
-    int dart2 = rand();
-
-    return dart2 > _prob[dart1]? dart1 : _alias[dart1];
-}
+template void build_alias_entries<int32_t>(const std::vector<double>& distribution,
+                                           const int32_t* topics,
+                                           AliasEntry* entries);
+template void build_alias_entries<uint16_t>(const std::vector<double>& distribution,
+                                            const int32_t* topics,
+                                            NarrowAliasEntry* entries);
 } // namespace familia